@@ -3,6 +3,11 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <stdint.h>
+#ifdef WIN32
+#include <io.h> /* for _setmode() */
+#include <fcntl.h>
+#endif
 #include <gsto_masses.h>
 #include <libgsto.h>
 #include "units.h"
@@ -17,7 +22,6 @@
 #define MAXEVENTS 10000000
 #define MAXVSTEP 201
 #define MAXDSTEP 201 /* Default for general->maxdstep */
-#define MAXSTOCHANGE 0.05
 
 
 #define TRUE  1
@@ -25,6 +29,10 @@
 
 #define TYPELEN 3
 
+#define TOF_LIST_MAGIC "\211TOFLIST" /* Packed records from tof_list -b follow */
+#define TOF_LIST_MAGIC_LENGTH 8
+#define TOF_LIST_RECORD_SIZE 52 /* Little-endian, see tof_list.c */
+
 #define I_BEAM     0
 #define I_ENERGY   1
 #define I_DETANGLE 2
@@ -38,7 +46,6 @@
 #define I_MAXDSTEP 10
 #define I_NITER 11
 
-#define F_MASSES DATAPATH/masses.dat
 #define NITER 4
 
 #define NABOVE 10    /* Output steps above the surface */
@@ -117,13 +124,13 @@ typedef struct {
 } General;
 
 typedef struct {
-   double vstep;
    int vsteps;
    double dstep;
-   double vdiv;
    double ddiv;
-   double ***ele; /* ele[0..maxelements][0..maxelements] */
-   double ***sum; /* sum[0..maxelements] */
+   gsto_table_t *table; /* Loaded stopping, kept for the mixtures */
+   gsto_mixture_t **mix; /* mix[0..maxdstep], target composition at each depth */
+   gsto_range_t ***range; /* range[0..maxelements][0..maxdstep], range of each element at each depth */
+   gsto_resample_cache_t *cache; /* Stopping resampled for the ranges, kept in GSTO_CACHE directory if set */
 } Stopping;
 
 typedef struct {
@@ -146,6 +153,10 @@ typedef struct {
 void read_command_line(int,char **,General *);
 void read_setup(General *,Measurement *,Concentration *);
 void read_events(General *,Measurement *,Event *,Concentration *);
+int binary_events(FILE *);
+int read_binary_event(FILE *,double *,double *,double *,int *,double *,char *,double *,int *);
+int32_t get_le32(const unsigned char *);
+double get_le64(const unsigned char *);
 char *read_inputline(char *,int);
 void file_error(char *,int);
 int get_nuclide(char *,int *,int *,double *);
@@ -158,12 +169,11 @@ void create_conc_profile(General *,Measurement *,Stopping *,
 void calculate_primary_energy(General *,Measurement *,Stopping *,
                               Concentration *);
 double get_eloss(General *, int,double,double,double,double,Stopping *);
-double inter_sto(General *,int,double,double,Stopping *);
 void calculate_recoil_depths(General *,Measurement *,Event *,
                              Stopping *,Concentration *);
 void output(General *,Concentration *,Event *);
 void clear_conc(General *, Concentration *);
-char *get_symbol(int);
+const char *get_symbol(int);
 double Lecuyer(int, int, double);
 double Andersen(int, int, double, double);
 double Serd(int,double,int,double,double,double, enum cross_section);
@@ -206,6 +216,7 @@ int main(int argc,char *argv[])
       calculate_recoil_depths(&general,&meas,event,&sto,&conc);
       create_conc_profile(&general,&meas,&sto,&conc);
    }
+   gsto_print_assignments(sto.table);
 
    output(&general,&conc,event);
 
@@ -219,8 +230,8 @@ int allocate_general_sto_conc(General *general, Measurement *meas, Stopping *sto
     general->element[meas->Z] ++;
     general->nuclide = (int **) calloc(general->maxelements, sizeof(int *));
     general->M = (double *) calloc(general->maxelements, sizeof(double));
-    sto->ele = (double ***) calloc(general->maxelements, sizeof(double **));
-    sto->sum = (double ***) calloc(general->maxelements, sizeof(double **));
+    sto->mix = (gsto_mixture_t **) calloc(general->maxdstep, sizeof(gsto_mixture_t *));
+    sto->range = (gsto_range_t ***) calloc(general->maxelements, sizeof(gsto_range_t **));
     conc->w = (double **) calloc(general->maxelements, sizeof(double *));
     conc->n = (int **) calloc(general->maxelements,  sizeof(int *));
     conc->wsum = (double *) calloc(general->maxdstep, sizeof(double));
@@ -231,13 +242,15 @@ int allocate_general_sto_conc(General *general, Measurement *meas, Stopping *sto
     conc->nprofile = (int ***) calloc(general->maxelements, sizeof(int **));
     for(i=0; i<general->maxelements; i++) {
         general->nuclide[i]=(int *)calloc(general->maxnucmasses, sizeof(int));
-        sto->ele[i] = (double **)calloc(general->maxelements, sizeof(double *));
         conc->w[i] = (double *) calloc(general->maxdstep, sizeof(double));
         conc->n[i] = (int *) calloc(general->maxdstep, sizeof(int));
         conc->wprofile[i] = (double **) calloc(general->maxnucmasses, sizeof(double *)); 
         conc->nprofile[i] = (int **) calloc(general->maxnucmasses, sizeof(int *));
     }
-    if(general->element && general->nuclide && general->M && sto->ele && sto->sum) {
+    for(i=0; i<general->maxdstep; i++) {
+        sto->mix[i] = gsto_mixture_allocate(general->maxelements);
+    }
+    if(general->element && general->nuclide && general->M && sto->mix && sto->range) {
         return 0;
     } else {
         fprintf(stderr, "Could not allocate general tables etc.\n");
@@ -410,33 +423,20 @@ void output(General *general,Concentration *conc,Event *event)
    fclose(fp);
 
 }
-char *get_symbol(int z)
+const char *get_symbol(int z)
 {
-   FILE *fp;
-   char *sym;
-   int cont=TRUE,Z,c;
-
-   sym = (char *) malloc(sizeof(char)*NELESYM);
-   
-   fp = fopen(XSTR(F_MASSES),"r");
+   isotopes_t *isotopes = gsto_isotopes();
+   const char *sym = NULL;
 
-   if(fp == NULL){
-      fprintf(stderr,"Could not open mass file %s\n",XSTR(F_MASSES));
+   if(isotopes == NULL){
+      fprintf(stderr,"Could not load the table of isotopes\n");
       exit(4);
    }
 
-   while(cont){
-      c = fscanf(fp,"%*i %i %*i %s %*f %*f\n",&Z,sym);
-      if(c == 2){
-         if(z == Z){
-            fclose(fp);
-            return(sym);
-         }
-      } else {
-         cont = FALSE;
-         fprintf(stderr,"Could not find elemental symbol for Z=%i\n",z);
-         exit(7);
-      }
+   sym = find_symbol(isotopes,z);
+   if(sym == NULL){
+      fprintf(stderr,"Could not find elemental symbol for Z=%i\n",z);
+      exit(7);
    }
    return(sym);
       
@@ -629,72 +629,32 @@ void calculate_primary_energy(General *general,Measurement *meas,Stopping *sto,
 }
 double get_eloss(General *general, int z,double m,double E,double d,double deltad,Stopping *sto)
 {
-   double dstep,dE,s1=0,s2=0,v,v2,r,dmin,dmax;
-
-   dE = 0.0;
-   dstep = deltad;
+   double dm,f,x,E1,E2;
+   int id;
 
    if(E <= 0.0)
       return(0.0);
 
-   v = sqrt((2.0*E)/m);
-
-   dmin = d;
-   dmax = (d + deltad)*1.000001;
+   /* Composition is interpolated between depth steps at the middle of the layer */
+   dm = d + 0.5*deltad;
+   id = (int) (dm*sto->ddiv);
+   id = min(max(0,id),general->maxdstep-2);
+   f = min(max(0.0,dm*sto->ddiv - id),1.0);
 
-   while((dmax - d) >= dstep){
-      do {
-         s1 = inter_sto(general, z,v,d,sto);
-         if(E < s1*dstep)
-            return(0.0);
-         v2 = sqrt((2.0*(E - s1*dstep))/m);
-         s2 = inter_sto(general, z,v2,d+dstep,sto);
-   
-         r = fabs(s2 - s1)/s1;
-   
-         if(r > MAXSTOCHANGE){
-            dstep /= 2.0;
-         }
-      } while(r > MAXSTOCHANGE);
-      dE += 0.5*(s1 + s2)*dstep;
-      d += dstep;
-   }
-
-   dE += (dmax - d)*0.5*(s1 + s2);
-
-   return(dE);
-
-}
-double inter_sto(General *general, int z1,double v,double d,Stopping *sto)
-{
-   double **S;
-   double value,s1,s2,vdiv,ddiv;
-   int iv,id;
-   
-   S = sto->sum[z1];
-
-   vdiv = sto->vdiv;
-   ddiv = sto->ddiv;
-
-   iv = (int) (v*vdiv);
-   iv = min(max(0.0,iv),sto->vsteps-2);
+   x = deltad/(1.0e15/C_CM2);
+   E1 = (sto->range[z][id])?gsto_range_E_after(sto->range[z][id],m,E,x):E;
+   E2 = (sto->range[z][id+1])?gsto_range_E_after(sto->range[z][id+1],m,E,x):E;
+   if(E1 < 0.0 || E2 < 0.0) /* Beyond the range tables */
+      return(0.0);
 
-   id = (int) (d*ddiv);
-   id = min(max(0.0,id),general->maxdstep-2);
+   return(E - (E1 + f*(E2 - E1)));
 
-   s1 = S[iv][id] + (v*vdiv - iv)*(S[iv+1][id] - S[iv][id]);
-   s2 = S[iv][id+1] + (v*vdiv - iv)*(S[iv+1][id+1] - S[iv][id+1]);   
-   
-   value = s1 + (d*ddiv - id)*(s2 - s1);
-   
-   return(value);
-  
 }
 void create_conc_profile(General *general,Measurement *meas,
                          Stopping *sto,Concentration *conc)
 {
-   double d=0.0,**p;
-   int iz1,iz2,id,iv,minn,n,nsum;
+   double d=0.0;
+   int iz1,iz2,id,minn,n,nsum;
 
    sto->dstep = conc->dstep;
    sto->ddiv = 1.0/conc->dstep;   
@@ -735,37 +695,27 @@ void create_conc_profile(General *general,Measurement *meas,
 
    for(iz1=1;iz1<general->maxelements;iz1++){
       if(general->element[iz1] > 0){
-         if(sto->sum[iz1] == NULL){
-               p = (double **) malloc(sizeof(double *)*sto->vsteps);
-               for(iv=0;iv<sto->vsteps;iv++)
-                  p[iv] = malloc(sizeof(double)*general->maxdstep);
-               sto->sum[iz1] = p;         
+         if(sto->range[iz1] == NULL)
+               sto->range[iz1] = (gsto_range_t **) calloc(general->maxdstep, sizeof(gsto_range_t *));
+         for(id=0;id<general->maxdstep;id++){
+            gsto_range_deallocate(sto->range[iz1][id]);
+            sto->range[iz1][id] = NULL;
          }
-         for(id=0;id<general->maxdstep;id++)
-            for(iv=0;iv<sto->vsteps;iv++)
-               sto->sum[iz1][iv][id] = 0.0;         
       } 
    }
    
+   for(id=0;id<general->maxdstep;id++)
+      for(iz2=1;iz2<general->maxelements;iz2++)
+         if(general->element[iz2] > 0)
+            gsto_mixture_set_fraction(sto->mix[id],iz2,conc->w[iz2][id]);
+
    for(iz1=1;iz1<general->maxelements;iz1++){
       if(general->element[iz1] > 0){
-         for(iz2=1;iz2<general->maxelements;iz2++)
-            if(general->element[iz2] > 0){
-               for(id=0;id<general->maxdstep;id++)
-                  for(iv=0;iv<sto->vsteps;iv++)
-                     sto->sum[iz1][iv][id] += 
-                          conc->w[iz2][id]*sto->ele[iz1][iz2][iv];
-            }
-               
+         for(id=0;id<general->maxdstep;id++)
+            sto->range[iz1][id] = gsto_range_build_cached(sto->cache,sto->table,sto->mix[id],iz1,general->vmax,sto->vsteps);
       }   
    }
 
-#ifdef DEBUG
-   for(iv=0;iv<sto->vsteps;iv++){
-      printf("%3i %10.4f %14.5e\n",iv,conc->w[14][0],sto->sum[53][iv][0]);
-   }
-#endif
-
    printf("\n");
 
    for(id=0;id<general->maxdstep/10;id++){
@@ -797,49 +747,33 @@ void clear_conc(General *general, Concentration *conc)
 }
 
 void calculate_stoppings(General *general, Measurement *meas, Stopping *sto) {
-    int z1, z2;
-    int s;
+    int z1;
     gsto_table_t *table;
     for(z1=1;z1<general->maxelements;z1++){
-        sto->sum[z1] = NULL;
-        for(z2=1;z2<general->maxelements;z2++){      
-            sto->ele[z1][z2] = NULL;
-        }
-    }
-    table=gsto_init(general->maxelements, XSTR(STOPPING_DATA));
-    if(!table) {
-        fprintf(stderr, "Could not init stopping table.\n");
-        return;
+        sto->range[z1] = NULL;
     }
     sto->vsteps=1001; /* FIXME: Dynamically set parameter. Verify v_max and v_steps and everything... */
-    for(z1=0;z1<general->maxelements;z1++){
-             for(z2=0;z2<general->maxelements;z2++){
-                if(general->element[z1] > 0 && general->element[z2]>0) {
-                    gsto_auto_assign(table, z1, z2);
-                }
-             }
-    }
-    if(!gsto_load(table)) {
-        fprintf(stderr, "Error in loading stopping.\n");
-        return;
-    }
-    gsto_print_assignments(table);
-    
-    general->vmax *= 1.2;
-    sto->vstep = general->vmax/(sto->vsteps - 1.0);
-    sto->vdiv = 1.0/sto->vstep;
-    
-    for(z1=0;z1<general->maxelements;z1++){
-        for(z2=0;z2<general->maxelements;z2++){
-            if(general->element[z1] > 0 && general->element[z2]>0) {
-                sto->ele[z1][z2]=gsto_sto_v_table(table, z1, z2, 0, general->vmax, sto->vsteps); /* 0 as a v_min, does it give any trouble? */
-                for(s=0; s<sto->vsteps; s++) {
-                    sto->ele[z1][z2][s] *= C_EVCM2_1E15ATOMS; /* Units conversion */
-                }
-            }
+    if(getenv("GSTO_SHM")) { /* Share one loaded copy of the stopping between processes */
+        table=gsto_init_shm(general->maxelements, XSTR(STOPPING_DATA), getenv("GSTO_SHM"));
+        if(!table) {
+            fprintf(stderr, "Could not init stopping table.\n");
+            return;
+        }
+    } else {
+        table=gsto_init(general->maxelements, XSTR(STOPPING_DATA));
+        if(!table) {
+            fprintf(stderr, "Could not init stopping table.\n");
+            return;
+        }
+        gsto_set_lazy(table, 1); /* Combinations of the elements in the sample are loaded as the mixtures need them */
+        if(!gsto_load(table)) {
+            fprintf(stderr, "Error in loading stopping.\n");
+            return;
         }
     }
-    gsto_deallocate(table);
+    general->vmax *= 1.2;
+    sto->table = table; /* Stopping in the target is combined from this by the mixtures in create_conc_profile */
+    sto->cache = getenv("GSTO_CACHE")?gsto_resample_cache_allocate(getenv("GSTO_CACHE")):NULL;
 }
 
 void read_command_line(int argc,char *argv[],General *general)
@@ -1008,12 +942,15 @@ void read_events(General *general,Measurement *meas,Event *event,
    FILE *fp;
    char buf[NLINE],type[TYPELEN+1];
    double x,y,E,M,w,det_dist;
-   int c,Z,A,n,i=0,cont=TRUE,j,k;
+   int c,Z,A,n,i=0,cont=TRUE,j,k,binary;
 
-   if(!strncmp(general->eventfile,"-",1) && strlen(general->eventfile) == 1)
+   if(!strncmp(general->eventfile,"-",1) && strlen(general->eventfile) == 1){
       fp = stdin;
-   else
-      fp = fopen(general->eventfile,"r");
+#ifdef WIN32
+      _setmode(_fileno(stdin), _O_BINARY);
+#endif
+   } else
+      fp = fopen(general->eventfile,"rb");
 
    if(fp == NULL){
       fprintf(stderr,"Could not open file %s\n",general->eventfile);
@@ -1021,12 +958,15 @@ void read_events(General *general,Measurement *meas,Event *event,
    }
 
    det_dist = meas->det_dist/C_MM;
+   binary = binary_events(fp);
    
-   while(fgets(buf,NLINE,fp) != NULL && cont){
-      c = sscanf(buf,"%lf %lf %lf %i %lf %s %lf %i",
-                 &x,&y,&E,&Z,&M,type,&w,&n);
-      if(c != 8){
-         fprintf(stderr,"Problems at input line %i\n",i+1);
+   while((binary?read_binary_event(fp,&x,&y,&E,&Z,&M,type,&w,&n):fgets(buf,NLINE,fp) != NULL) && cont){
+      if(!binary){
+         c = sscanf(buf,"%lf %lf %lf %i %lf %s %lf %i",
+                    &x,&y,&E,&Z,&M,type,&w,&n);
+         if(c != 8){
+            fprintf(stderr,"Problems at input line %i\n",i+1);
+         }
       }
       if(i < MAXEVENTS){
          event[i].theta = meas->detector_angle + x;
@@ -1082,19 +1022,67 @@ void read_events(General *general,Measurement *meas,Event *event,
    fprintf(stderr,"%i events read\n",general->nevents);
    
 }
+int binary_events(FILE *fp) /* TRUE if events are records from tof_list -b, the magic is skipped */
+{
+   char magic[TOF_LIST_MAGIC_LENGTH];
+   int c = getc(fp);
+
+   if(c == EOF)
+      return FALSE;
+   ungetc(c,fp);
+   if(c != (unsigned char) TOF_LIST_MAGIC[0])
+      return FALSE;
+   if(fread(magic,1,TOF_LIST_MAGIC_LENGTH,fp) != TOF_LIST_MAGIC_LENGTH ||
+      memcmp(magic,TOF_LIST_MAGIC,TOF_LIST_MAGIC_LENGTH) != 0){
+      fprintf(stderr,"Events are neither text nor binary from tof_list\n");
+      exit(2);
+   }
+   return TRUE;
+}
+int read_binary_event(FILE *fp,double *x,double *y,double *E,int *Z,
+                      double *M,char *type,double *w,int *n)
+{
+   unsigned char rec[TOF_LIST_RECORD_SIZE];
+
+   if(fread(rec,1,TOF_LIST_RECORD_SIZE,fp) != TOF_LIST_RECORD_SIZE)
+      return FALSE;
+   *x = get_le64(rec);
+   *y = get_le64(rec+8);
+   *E = get_le64(rec+16);
+   *Z = get_le32(rec+24);
+   *M = get_le64(rec+28);
+   strcpy(type,get_le32(rec+36)?"ERD":"RBS");
+   *w = get_le64(rec+40);
+   *n = get_le32(rec+48);
+   return TRUE;
+}
+int32_t get_le32(const unsigned char *p) /* Same on any host byte order */
+{
+   return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                    (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+double get_le64(const unsigned char *p) /* IEEE 754 double */
+{
+   uint64_t bits = 0;
+   double d;
+   int i;
+
+   for(i=7; i >= 0; i--)
+      bits = bits << 8 | p[i];
+   memcpy(&d,&bits,8);
+   return d;
+}
 int get_nuclide(char *symbol,int *Z,int *A,double *M)
 {
-   FILE *fp;
-   char S0[NELESYM];
-   double M0,C0,maxC=0.0;
-   int c=0,len,N0,Z0,A0,cont=TRUE;
+   isotopes_t *isotopes = gsto_isotopes();
+   isotope_t *isotope;
+   char name[MAX_ELEMENT_NAME];
+   int c=0,len;
    
    len = strlen(symbol);
    
-   fp = fopen(XSTR(F_MASSES),"r");
-   
-   if(fp == NULL){
-      fprintf(stderr,"Could not open mass file %s\n",XSTR(F_MASSES));
+   if(isotopes == NULL){
+      fprintf(stderr,"Could not load the table of isotopes\n");
       exit(4);
    }
    
@@ -1112,33 +1100,19 @@ int get_nuclide(char *symbol,int *Z,int *A,double *M)
    } else
       *A = 0;
                
-   while(cont){
-      c = fscanf(fp,"%i %i %i %s %lf %lf\n",&N0,&Z0,&A0,S0,&M0,&C0);
-      if(c == 6){
-         if(*A > 0){
-            if(strcmp(symbol,S0) == 0 && *A == A0){
-               *Z = Z0;
-               *M = M0*1e-6*C_U;
-               cont = FALSE;
-            }
-         } else {
-            if(strcmp(symbol,S0) == 0 && C0 > maxC){
-               *Z = Z0;
-               *A = A0;
-               *M = M0*1e-6*C_U;
-               maxC = C0;
-            }
-         }
-      } else 
-         cont = FALSE;
-   }
-   
-   fclose(fp);                    
+   if(*A > 0){
+      snprintf(name,MAX_ELEMENT_NAME,"%i-%s",*A,symbol);
+      isotope = find_isotope_by_name(isotopes,name);
+   } else
+      isotope = find_most_abundant_isotope(isotopes,find_Z_by_name(isotopes,symbol));
 
-   if(c == EOF)
+   if(isotope == NULL)
       return(FALSE);
-   else
-      return(TRUE);
+
+   *Z = isotope->Z;
+   *A = isotope->A;
+   *M = isotope->mass_micro_u*1e-6*C_U;
+   return(TRUE);
  
 }
 double ipow2(double x)
@@ -0,0 +1,324 @@
+/*
+    Benchmark of loading and looking up stopping.
+
+    gsto_bench [-n lookups] [-z Z_max] [-r reference_file] [settings_file ...]
+
+    For every settings file (default is the installed stoppings.txt) the time
+    to load everything, to load lazily and look up one combination, and to
+    write and map a cache file is measured. Lookups per second are then
+    measured with the first settings file for the scalar (velocity and
+    energy), handle, batched (gsto_sto_v_table and gsto_resample) and
+    mixture APIs, for every storage and interpolation, and conversions
+    between energy and velocity per second.
+
+    The accuracy of each storage and interpolation is given as the relative
+    difference to reference values. The reference file has lines
+    "Z1 Z2 E S" with E in keV/u and S in eV/(1e15 at/cm^2). Without one,
+    double precision linear interpolation is the reference.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <libgsto.h>
+#include <gsto_kinematics.h>
+
+#define C_KEV 1.6021917e-16 /* J */
+#define C_AMU 1.66044e-27 /* kg */
+
+#define STOPPING_DATA DATAPATH/stoppings.txt
+#define XSTR(x) STR(x)
+#define STR(x) #x
+
+#define BENCH_LOOKUPS 1000000
+#define BENCH_Z_MAX 92
+#define BENCH_E_MIN 10.0 /* keV/u */
+#define BENCH_E_MAX 10000.0 /* keV/u */
+#define BENCH_BATCH 1000 /* Points per gsto_sto_v_table() call */
+#define BENCH_CACHE "gsto_bench.cache"
+#define BENCH_MAX_REFERENCES 100000
+
+typedef struct {
+    int Z1;
+    int Z2;
+    double v; /* m/s */
+    double E; /* keV/u */
+    double sto; /* Reference value, 0 if none */
+} lookup_t;
+
+static volatile double bench_sink; /* Keeps the lookups from being optimized away */
+static unsigned long long bench_state=88172645463325252ULL;
+
+static double bench_random(void) { /* Uniform in [0,1), xorshift so that every run looks up the same values */
+    bench_state ^= bench_state << 13;
+    bench_state ^= bench_state >> 7;
+    bench_state ^= bench_state << 17;
+    return (bench_state >> 11)*(1.0/9007199254740992.0);
+}
+
+static double bench_seconds(void) {
+    return (double)clock()/CLOCKS_PER_SEC;
+}
+
+static double bench_v(double E) { /* keV/u to m/s, classical is accurate enough here */
+    return sqrt(2.0*E*C_KEV/C_AMU);
+}
+
+static gsto_table_t *bench_load(char *settings, int Z_max, gsto_storage_t storage, stopping_interpolation_t interpolation, int lazy) {
+    gsto_table_t *table=gsto_init(Z_max, settings);
+    if(!table)
+        return NULL;
+    gsto_set_storage(table, storage);
+    gsto_set_interpolation(table, interpolation);
+    gsto_set_lazy(table, lazy);
+    if(!lazy)
+        gsto_auto_assign_range(table, 1, Z_max, 1, Z_max);
+    if(!gsto_load(table)) {
+        gsto_deallocate(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void bench_loading(char *settings, int Z_max) {
+    double t0, t_eager, t_lazy, t_write, t_map;
+    gsto_table_t *table, *cached;
+    t0=bench_seconds();
+    table=bench_load(settings, Z_max, GSTO_STORAGE_DOUBLE, GSTO_INTERP_LINEAR, 0);
+    t_eager=bench_seconds()-t0;
+    if(!table) {
+        fprintf(stderr, "Could not load stopping using %s.\n", settings);
+        return;
+    }
+    t0=bench_seconds();
+    cached=bench_load(settings, Z_max, GSTO_STORAGE_DOUBLE, GSTO_INTERP_LINEAR, 1);
+    if(cached)
+        gsto_sto_v(cached, 2, 14, bench_v(100.0));
+    t_lazy=bench_seconds()-t0;
+    gsto_deallocate(cached);
+    t0=bench_seconds();
+    gsto_cache_write(table, BENCH_CACHE);
+    t_write=bench_seconds()-t0;
+    t0=bench_seconds();
+    cached=gsto_cache_load(BENCH_CACHE);
+    t_map=bench_seconds()-t0;
+    printf("%s: %i combinations, %.1f MB\n", settings, table->n_pairs, table->arena_points*sizeof(double)/1.0e6);
+    printf("    load %.3f s, lazy load and one lookup %.3f s, cache write %.3f s, cache load %.3f s%s\n", t_eager, t_lazy, t_write, t_map, cached?"":" (failed)");
+    gsto_deallocate(cached);
+    gsto_deallocate(table);
+    remove(BENCH_CACHE);
+}
+
+static int bench_references(char *filename, lookup_t *lookups, int n_max) {
+    int n=0;
+    double E;
+    FILE *fp=fopen(filename, "r");
+    if(!fp) {
+        fprintf(stderr, "Could not open reference file %s.\n", filename);
+        return 0;
+    }
+    while(n < n_max && fscanf(fp, "%i %i %lf %lf", &lookups[n].Z1, &lookups[n].Z2, &E, &lookups[n].sto) == 4) {
+        lookups[n].v=bench_v(E);
+        lookups[n].E=E;
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+static void bench_lookups(const gsto_table_t *table, const lookup_t *lookups, int n) {
+    int i, j;
+    double t0, t, sum=0.0, *sto;
+    gsto_handle_t *handle;
+    gsto_mixture_t *mixture;
+    gsto_grid_t grid;
+    t0=bench_seconds();
+    for(i=0; i<n; i++) {
+        sum += gsto_sto_v(table, lookups[i].Z1, lookups[i].Z2, lookups[i].v);
+    }
+    t=bench_seconds()-t0;
+    printf("    gsto_sto_v %.2e/s", n/t);
+    t0=bench_seconds();
+    for(i=0; i<n; i++) {
+        sum += gsto_sto_E_per_u(table, lookups[i].Z1, lookups[i].Z2, lookups[i].E);
+    }
+    t=bench_seconds()-t0;
+    printf(", gsto_sto_E_per_u %.2e/s", n/t);
+    handle=gsto_handle_allocate(table);
+    t0=bench_seconds();
+    for(i=0; i<n; i++) {
+        sum += gsto_handle_sto_v(handle, lookups[i].Z1, lookups[i].Z2, lookups[i].v);
+    }
+    t=bench_seconds()-t0;
+    gsto_handle_deallocate(handle);
+    printf(", gsto_handle_sto_v %.2e/s", n/t);
+    t0=bench_seconds();
+    for(i=0; i+BENCH_BATCH<=n; i+=BENCH_BATCH) {
+        sto=gsto_sto_v_table(table, lookups[i].Z1, lookups[i].Z2, bench_v(BENCH_E_MIN), bench_v(BENCH_E_MAX), BENCH_BATCH);
+        for(j=0; j<BENCH_BATCH; j++) {
+            sum += sto[j];
+        }
+        free(sto);
+    }
+    t=bench_seconds()-t0;
+    printf(", gsto_sto_v_table %.2e/s", i/t);
+    grid.unit=GSTO_GRID_E_PER_U;
+    grid.mass=0.0;
+    grid.x_min=BENCH_E_MIN;
+    grid.x_max=BENCH_E_MAX;
+    grid.points=BENCH_BATCH;
+    sto=malloc(sizeof(double)*BENCH_BATCH);
+    t0=bench_seconds();
+    for(i=0; i+BENCH_BATCH<=n; i+=BENCH_BATCH) {
+        gsto_resample(table, lookups[i].Z1, lookups[i].Z2, &grid, sto);
+        for(j=0; j<BENCH_BATCH; j++) {
+            sum += sto[j];
+        }
+    }
+    t=bench_seconds()-t0;
+    free(sto);
+    printf(", gsto_resample %.2e/s", i/t);
+    mixture=gsto_mixture_allocate(table->Z1_max);
+    gsto_mixture_set_fraction(mixture, 8, 2.0); /* SiO2 */
+    gsto_mixture_set_fraction(mixture, 14, 1.0);
+    t0=bench_seconds();
+    for(i=0; i<n; i++) {
+        sum += gsto_mixture_sto_v(table, mixture, lookups[i].Z1, lookups[i].v);
+    }
+    t=bench_seconds()-t0;
+    gsto_mixture_deallocate(mixture);
+    printf(", gsto_mixture_sto_v %.2e/s\n", n/t);
+    bench_sink=sum;
+}
+
+static void bench_kinematics(const lookup_t *lookups, int n) {
+    int i;
+    double t0, t, sum=0.0, *E, *v;
+    E=malloc(sizeof(double)*n);
+    v=malloc(sizeof(double)*n);
+    t0=bench_seconds();
+    for(i=0; i<n; i++) {
+        E[i]=gsto_energy(lookups[i].v, C_AMU);
+    }
+    t=bench_seconds()-t0;
+    printf("    gsto_energy %.2e/s", n/t);
+    t0=bench_seconds();
+    for(i=0; i<n; i++) {
+        sum += gsto_velocity(E[i], C_AMU);
+    }
+    t=bench_seconds()-t0;
+    printf(", gsto_velocity %.2e/s", n/t);
+    t0=bench_seconds();
+    gsto_velocities(E, v, n, C_AMU);
+    t=bench_seconds()-t0;
+    printf(", gsto_velocities %.2e/s\n", n/t);
+    sum += v[n-1];
+    bench_sink=sum;
+    free(E);
+    free(v);
+}
+
+static void bench_accuracy(const gsto_table_t *table, const lookup_t *lookups, int n, const char *reference) {
+    int i, count=0;
+    double sto, delta, max=0.0, sum2=0.0;
+    for(i=0; i<n; i++) {
+        if(lookups[i].sto <= 0.0)
+            continue;
+        sto=gsto_sto_v(table, lookups[i].Z1, lookups[i].Z2, lookups[i].v);
+        if(sto <= 0.0) /* Outside the table */
+            continue;
+        delta=fabs(sto/lookups[i].sto-1.0);
+        if(delta > max)
+            max=delta;
+        sum2 += delta*delta;
+        count++;
+    }
+    if(count)
+        printf("    relative difference to %s: max %.2e, rms %.2e (%i points)\n", reference, max, sqrt(sum2/count), count);
+}
+
+int main(int argc, char **argv) {
+    int i, n=BENCH_LOOKUPS, n_references=0, Z_max=BENCH_Z_MAX, storage, interpolation, first=1;
+    char *reference_file=NULL;
+    char *default_settings=XSTR(STOPPING_DATA);
+    char **settings=&default_settings;
+    int n_settings=1;
+    gsto_table_t *table;
+    lookup_t *lookups, *references=NULL;
+    while(first < argc && argv[first][0] == '-' && first+1 < argc) {
+        if(strcmp(argv[first], "-n") == 0) {
+            n=strtol(argv[first+1], NULL, 10);
+        } else if(strcmp(argv[first], "-z") == 0) {
+            Z_max=strtol(argv[first+1], NULL, 10);
+        } else if(strcmp(argv[first], "-r") == 0) {
+            reference_file=argv[first+1];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[first]);
+            return 0;
+        }
+        first += 2;
+    }
+    if(first < argc) {
+        settings=argv+first;
+        n_settings=argc-first;
+    }
+    if(n < BENCH_BATCH || Z_max < 1) {
+        fprintf(stderr, "Need at least %i lookups and Z_max >= 1.\n", BENCH_BATCH);
+        return 0;
+    }
+    printf("Loading\n");
+    for(i=0; i<n_settings; i++) {
+        bench_loading(settings[i], Z_max);
+    }
+    table=bench_load(settings[0], Z_max, GSTO_STORAGE_DOUBLE, GSTO_INTERP_LINEAR, 0);
+    if(!table) {
+        fprintf(stderr, "Could not load stopping using %s.\n", settings[0]);
+        return 0;
+    }
+    if(table->n_pairs == 0) { /* Nothing to look up, the loop below would never end */
+        fprintf(stderr, "No stopping for any combination up to Z=%i in %s.\n", Z_max, settings[0]);
+        gsto_deallocate(table);
+        return 0;
+    }
+    lookups=malloc(sizeof(lookup_t)*n);
+    for(i=0; i<n; i++) { /* Assigned combinations only, velocities evenly in log(E) */
+        do {
+            lookups[i].Z1=1+(int)(bench_random()*Z_max);
+            lookups[i].Z2=1+(int)(bench_random()*Z_max);
+        } while(table->pair_ids[lookups[i].Z1*(table->Z2_max+1)+lookups[i].Z2] < 0);
+        lookups[i].E=BENCH_E_MIN*pow(BENCH_E_MAX/BENCH_E_MIN, bench_random());
+        lookups[i].v=bench_v(lookups[i].E);
+        lookups[i].sto=0.0;
+    }
+    if(reference_file) {
+        references=malloc(sizeof(lookup_t)*BENCH_MAX_REFERENCES);
+        n_references=bench_references(reference_file, references, BENCH_MAX_REFERENCES);
+    } else {
+        for(i=0; i<n; i++) {
+            lookups[i].sto=gsto_sto_v(table, lookups[i].Z1, lookups[i].Z2, lookups[i].v);
+        }
+    }
+    gsto_deallocate(table);
+    printf("Kinematics (%i)\n", n);
+    bench_kinematics(lookups, n);
+    printf("Lookups (%i) using %s\n", n, settings[0]);
+    for(storage=0; storage<GSTO_N_STORAGES; storage++) {
+        for(interpolation=GSTO_INTERP_LINEAR; interpolation<GSTO_N_INTERPOLATIONS; interpolation++) {
+            table=bench_load(settings[0], Z_max, storage, interpolation, 0);
+            if(!table)
+                continue;
+            printf("%s, %s interpolation\n", storage==GSTO_STORAGE_FLOAT?"float":"double", interpolation==GSTO_INTERP_CUBIC?"cubic":"linear");
+            bench_lookups(table, lookups, n);
+            if(reference_file)
+                bench_accuracy(table, references, n_references, reference_file);
+            else
+                bench_accuracy(table, lookups, n, "double precision linear interpolation");
+            gsto_deallocate(table);
+        }
+    }
+    free(lookups);
+    free(references);
+    return 1;
+}
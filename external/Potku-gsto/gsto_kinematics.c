@@ -0,0 +1,37 @@
+#include "gsto_kinematics.h"
+
+void gsto_velocities(const double *E, double *v, int n, double mass) { /* v[i] of E[i], arrays may be the same */
+    int i;
+    double x_max=0.0;
+    for(i=0; i<n; i++) {
+        if(E[i] > x_max)
+            x_max=E[i];
+    }
+    if(x_max/(mass*GSTO_KINEMATICS_C2) < GSTO_KINEMATICS_CLASSICAL) { /* Whole array classical, the branch is out of the loop */
+        for(i=0; i<n; i++) {
+            v[i]=sqrt(2.0*E[i]/mass)*(1.0-0.75*E[i]/(mass*GSTO_KINEMATICS_C2));
+        }
+        return;
+    }
+    for(i=0; i<n; i++) {
+        v[i]=gsto_velocity(E[i], mass);
+    }
+}
+
+void gsto_energies(const double *v, double *E, int n, double mass) { /* E[i] of v[i], arrays may be the same */
+    int i;
+    double v2_max=0.0;
+    for(i=0; i<n; i++) {
+        if(v[i]*v[i] > v2_max)
+            v2_max=v[i]*v[i];
+    }
+    if(v2_max/GSTO_KINEMATICS_C2 < GSTO_KINEMATICS_CLASSICAL) {
+        for(i=0; i<n; i++) {
+            E[i]=0.5*mass*v[i]*v[i]*(1.0+0.75*(v[i]*v[i]/GSTO_KINEMATICS_C2));
+        }
+        return;
+    }
+    for(i=0; i<n; i++) {
+        E[i]=gsto_energy(v[i], mass);
+    }
+}
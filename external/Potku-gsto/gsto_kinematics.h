@@ -0,0 +1,32 @@
+/*
+    Relativistic kinematics in SI units, without pow().
+
+    gsto_velocity() and gsto_energy() are inlined for use in inner loops,
+    gsto_velocities() and gsto_energies() convert arrays of values for one
+    mass. When E/mc^2 (or (v/c)^2) is below GSTO_KINEMATICS_CLASSICAL the
+    classical result with a first order correction is used, its relative
+    error is below 1e-12 there.
+*/
+
+#include <math.h>
+
+#define GSTO_KINEMATICS_C2 8.9875518e+16 /* m^2/s^2 */
+#define GSTO_KINEMATICS_CLASSICAL 1.0e-6
+
+static inline double gsto_velocity(double E, double mass) { /* Velocity (m/s) of a particle with kinetic energy E (J) and mass (kg) */
+    double x=E/(mass*GSTO_KINEMATICS_C2);
+    if(x < GSTO_KINEMATICS_CLASSICAL)
+        return sqrt(2.0*E/mass)*(1.0-0.75*x);
+    return sqrt(x*(2.0+x)*GSTO_KINEMATICS_C2)/(1.0+x); /* c*sqrt(1-1/gamma^2), gamma=1+x */
+}
+
+static inline double gsto_energy(double v, double mass) { /* Inverse of gsto_velocity() */
+    double beta2=v*v/GSTO_KINEMATICS_C2, s;
+    if(beta2 < GSTO_KINEMATICS_CLASSICAL)
+        return 0.5*mass*v*v*(1.0+0.75*beta2);
+    s=sqrt(1.0-beta2);
+    return mass*GSTO_KINEMATICS_C2*beta2/(s*(1.0+s)); /* mc^2*(gamma-1) without the cancellation */
+}
+
+void gsto_velocities(const double *E, double *v, int n, double mass);
+void gsto_energies(const double *v, double *E, int n, double mass);
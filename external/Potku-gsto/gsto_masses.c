@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <math.h>
 #include "gsto_masses.h"
+#include "gsto_kinematics.h"
 #include "win_compat.h"
 
 int add_isotope_to_table(isotopes_t *isotopes, int Z, int N, int A, char *name, double mass, double abundance) {
@@ -22,6 +23,8 @@ int add_isotope_to_table(isotopes_t *isotopes, int Z, int N, int A, char *name,
     isotope->A=A;
     isotope->mass=mass*AMU;
     isotope->abundance=abundance;
+    isotope->mass_micro_u=mass*1e6;
+    isotope->abundance_percent=abundance*1e2;
     if(N+Z != A) {
         fprintf(stderr, "Mass number A=%i does not match with N=%i and Z=%i\n", A, N, Z);
     }
@@ -32,12 +35,120 @@ int add_isotope_to_table(isotopes_t *isotopes, int Z, int N, int A, char *name,
 }
 
 
-isotopes_t *load_isotope_table(char *filename) {
+static unsigned int isotope_hash(const char *name) { /* FNV-1a */
+    unsigned int hash=2166136261U;
+    for(; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static const char *isotope_symbol(const isotope_t *isotope) { /* "He" of "4-He" */
+    const char *symbol=strchr(isotope->name, '-');
+    return symbol?symbol+1:isotope->name;
+}
+
+static int compare_isotopes(const void *a, const void *b) {
+    const isotope_t *i_a=a, *i_b=b;
+    if(i_a->Z != i_b->Z)
+        return i_a->Z-i_b->Z;
+    return i_a->A-i_b->A;
+}
+
+static int index_isotope_table(isotopes_t *isotopes) { /* Sort and build the lookup tables, once after loading */
+    int i, Z, slot;
+    double abundance;
+    isotope_t *isotope;
+    qsort(isotopes->i, isotopes->n_isotopes, sizeof(isotope_t), compare_isotopes);
+    isotopes->Z_max=isotopes->n_isotopes?isotopes->i[isotopes->n_isotopes-1].Z:0;
+    isotopes->Z_first=malloc(sizeof(int)*(isotopes->Z_max+2));
+    isotopes->average_mass=calloc(isotopes->Z_max+1, sizeof(double));
+    isotopes->most_abundant=calloc(isotopes->Z_max+1, sizeof(isotope_t *));
+    for(Z=0, i=0; Z<=isotopes->Z_max+1; Z++) {
+        while(i < isotopes->n_isotopes && isotopes->i[i].Z < Z)
+            i++;
+        isotopes->Z_first[Z]=i;
+    }
+    for(Z=0; Z<=isotopes->Z_max; Z++) {
+        abundance=0.0;
+        for(i=isotopes->Z_first[Z]; i<isotopes->Z_first[Z+1]; i++) {
+            isotope=&isotopes->i[i];
+            isotopes->average_mass[Z] += isotope->mass*isotope->abundance;
+            abundance += isotope->abundance;
+            if(isotope->abundance > 0.0 && (!isotopes->most_abundant[Z] || isotope->abundance > isotopes->most_abundant[Z]->abundance))
+                isotopes->most_abundant[Z]=isotope;
+        }
+        if(abundance > 0.0)
+            isotopes->average_mass[Z] /= abundance;
+    }
+    for(isotopes->hash_size=16; isotopes->hash_size < 2*isotopes->n_isotopes; isotopes->hash_size *= 2);
+    isotopes->name_hash=malloc(sizeof(int)*isotopes->hash_size);
+    isotopes->symbol_hash=malloc(sizeof(int)*isotopes->hash_size);
+    for(i=0; i<isotopes->hash_size; i++) {
+        isotopes->name_hash[i]=-1;
+        isotopes->symbol_hash[i]=-1;
+    }
+    for(i=0; i<isotopes->n_isotopes; i++) { /* Open addressing, linear probing */
+        for(slot=isotope_hash(isotopes->i[i].name)&(isotopes->hash_size-1); isotopes->name_hash[slot] >= 0; slot=(slot+1)&(isotopes->hash_size-1));
+        isotopes->name_hash[slot]=i;
+    }
+    for(Z=0; Z<=isotopes->Z_max; Z++) {
+        if(isotopes->Z_first[Z] == isotopes->Z_first[Z+1])
+            continue;
+        for(slot=isotope_hash(isotope_symbol(&isotopes->i[isotopes->Z_first[Z]]))&(isotopes->hash_size-1); isotopes->symbol_hash[slot] >= 0; slot=(slot+1)&(isotopes->hash_size-1));
+        isotopes->symbol_hash[slot]=Z;
+    }
+    return 1;
+}
+
+static isotopes_t *allocate_isotope_table(void) {
+    isotopes_t *isotopes=malloc(sizeof(isotopes_t));
+    if(!isotopes)
+        return NULL;
+    isotopes->n_isotopes=0;
+    isotopes->i = malloc(sizeof(isotope_t)*MASSES_MAX_ISOTOPES);
+    if(!isotopes->i) {
+        free(isotopes);
+        return NULL;
+    }
+    return isotopes;
+}
+
+static int add_isotope_entry(isotopes_t *isotopes, const gsto_masses_entry_t *entry) { /* Keeps the values of masses.dat as they were */
+    char name[MAX_ELEMENT_NAME];
+    isotope_t *isotope;
+    snprintf(name, MAX_ELEMENT_NAME, "%i-%s", entry->A, entry->symbol);
+    if(!add_isotope_to_table(isotopes, entry->Z, entry->N, entry->A, name, entry->mass/1e6, entry->abundance/1e2))
+        return 0;
+    isotope=&isotopes->i[isotopes->n_isotopes-1];
+    isotope->mass_micro_u=entry->mass;
+    isotope->abundance_percent=entry->abundance;
+    return 1;
+}
+
+static isotopes_t *load_builtin_isotope_table(void) { /* Compiled in from masses.dat, see gsto_masses_data.c */
+    int i;
+    isotopes_t *isotopes=allocate_isotope_table();
+    if(!isotopes)
+        return NULL;
+    for(i=0; i<gsto_masses_builtin_n; i++) {
+        add_isotope_entry(isotopes, &gsto_masses_builtin[i]);
+    }
+    index_isotope_table(isotopes);
+    return isotopes;
+}
+
+isotopes_t *load_isotope_table(char *filename) { /* filename NULL for the compiled in table */
     char *line, *line_split;
     char *columns[6];
     char **col;
-    char *name=calloc(MAX_ELEMENT_NAME,sizeof(char));
-    FILE *in_file=fopen(filename, "r");
+    gsto_masses_entry_t entry;
+    FILE *in_file;
+    isotopes_t *isotopes;
+    if(!filename)
+        return load_builtin_isotope_table();
+    in_file=fopen(filename, "r");
     if(!in_file) {
         fprintf(stderr, "Could not load isotope table from file %s\n", filename);
         return NULL;
@@ -45,124 +156,113 @@ isotopes_t *load_isotope_table(char *filename) {
     line=malloc(sizeof(char)*MASSES_LINE_LENGTH);
     if(!line) 
         return NULL;
-    isotopes_t *isotopes=malloc(sizeof(isotopes_t));
+    isotopes=allocate_isotope_table();
     if(!isotopes)
         return NULL;
-    isotopes->n_isotopes=0;
-    isotopes->i = malloc(sizeof(isotope_t)*MASSES_MAX_ISOTOPES);
-    if(!isotopes->i)
-        return NULL;
     while(fgets(line, MASSES_LINE_LENGTH, in_file) != NULL) {
         line_split=line; /* strsep will screw up line_split, reset for every new line */
         for (col = columns; (*col = strsep(&line_split, " \t")) != NULL;)
             if (**col != '\0')
                 if (++col >= &columns[6])
                     break;
-        snprintf(name, MAX_ELEMENT_NAME, "%i-%s", (int)strtol(columns[2], NULL, 10), columns[3]);
-        add_isotope_to_table(isotopes, strtoimax(columns[1], NULL, 10), strtoimax(columns[0], NULL, 10), strtoimax(columns[2], NULL, 10), name, strtod(columns[4], NULL)/1e6, strtod(columns[5], NULL)/1e2);
+        entry.N=strtoimax(columns[0], NULL, 10);
+        entry.Z=strtoimax(columns[1], NULL, 10);
+        entry.A=strtoimax(columns[2], NULL, 10);
+        entry.symbol=columns[3];
+        entry.mass=strtod(columns[4], NULL);
+        entry.abundance=strtod(columns[5], NULL);
+        add_isotope_entry(isotopes, &entry);
     }
     fclose(in_file);
+    free(line);
+    index_isotope_table(isotopes);
+    return isotopes;
+}
+
+isotopes_t *gsto_isotopes(void) {
+    static isotopes_t *isotopes=NULL;
+    if(!isotopes)
+        isotopes=load_isotope_table(getenv("GSTO_MASSES"));
     return isotopes;
 }
 
+const char *find_symbol(isotopes_t *isotopes, int Z) {
+    isotope_t *isotope=find_first_isotope(isotopes, Z);
+    return isotope?isotope_symbol(isotope):NULL;
+}
+
 isotope_t *find_first_isotope(isotopes_t *isotopes, int Z) {
-    int i;
-    isotope_t *isotope;
-    for(i=0; i<isotopes->n_isotopes; i++) {
-        isotope=&isotopes->i[i];
-        if(isotope->Z == Z) { /* The right element */
-            return isotope;
-        }
-    }
-    return NULL; /* Nothing found */
+    if(Z < 0 || Z > isotopes->Z_max || isotopes->Z_first[Z] == isotopes->Z_first[Z+1])
+        return NULL; /* Nothing found */
+    return &isotopes->i[isotopes->Z_first[Z]];
 }
 
+double find_average_mass(isotopes_t *isotopes, int Z) {
+    if(Z < 0 || Z > isotopes->Z_max)
+        return 0.0;
+    return isotopes->average_mass[Z];
+}
 
 double find_mass(isotopes_t *isotopes, int Z, int A) { /* if A=0 calculate average mass, otherwise return isotope mass */
-    double mass=0.0;
     isotope_t *isotope;
-    int i;
-    for(i=0; i<isotopes->n_isotopes; i++) {
-        isotope=&isotopes->i[i];
-        if(isotope->Z == Z) {
-            if(isotope->A == A) {
-                return isotope->mass;
-            }
-            if(isotope->A == 0) {
-                mass += isotope->mass*isotope->abundance;
-            }
-        }
-    }
-    return mass;
+    if(A == 0)
+        return find_average_mass(isotopes, Z);
+    isotope=find_isotope(isotopes, Z, A);
+    return isotope?isotope->mass:0.0;
 }
 
 int find_Z_by_name(isotopes_t *isotopes, char *name) { /* Give just element name e.g. "Cu" */
-    isotope_t *isotope;
-    char *isotope_name;
-    int i;
-    for(i=0; i<isotopes->n_isotopes; i++) {
-        isotope=&isotopes->i[i];
-        isotope_name=isotope->name;
-        while(isdigit(*isotope_name)) /* Skip numbers */
-            isotope_name++;
-        if(*isotope_name == '-') /* and dash */
-            isotope_name++;
-        if(strcmp(isotope_name, name) == 0) {
-            return isotope->Z;
+    int slot, Z;
+    for(slot=isotope_hash(name)&(isotopes->hash_size-1); (Z=isotopes->symbol_hash[slot]) >= 0; slot=(slot+1)&(isotopes->hash_size-1)) {
+        if(strcmp(isotope_symbol(&isotopes->i[isotopes->Z_first[Z]]), name) == 0) {
+            return Z;
         }
     }
     return 0;
 }
 
 isotope_t *find_most_abundant_isotope(isotopes_t *isotopes, int Z) {
-    int i;
-    isotope_t *isotope;
-    isotope_t *most_abundant_isotope=NULL;
-    double abundance=0;
-    for(i=0; i<isotopes->n_isotopes; i++) {
-        isotope=&isotopes->i[i];
-        if(isotope->Z == Z) { /* The right element */
-            if(isotope->abundance > abundance) { /* Has higher abundance than anything found so far */
-                abundance=isotope->abundance;
-                most_abundant_isotope=isotope;
-            }
-        }
-    }
-    return most_abundant_isotope;
+    if(Z < 0 || Z > isotopes->Z_max)
+        return NULL;
+    return isotopes->most_abundant[Z];
 }
 
 isotope_t *find_isotope(isotopes_t *isotopes, int Z, int A) {
-    isotope_t *isotope;
-    int i;
-    for(i=0; i<isotopes->n_isotopes; i++) {
-        isotope=&isotopes->i[i];
-        if(isotope->Z == Z && isotope->A == A) {
-            return isotope;
+    int i, first, last;
+    if(Z < 0 || Z > isotopes->Z_max)
+        return NULL;
+    first=isotopes->Z_first[Z];
+    last=isotopes->Z_first[Z+1]-1;
+    if(first > last || A < isotopes->i[first].A || A > isotopes->i[last].A)
+        return NULL;
+    i=first+A-isotopes->i[first].A; /* Mass numbers of an element are usually consecutive */
+    if(i <= last && isotopes->i[i].A == A)
+        return &isotopes->i[i];
+    for(i=first; i<=last; i++) {
+        if(isotopes->i[i].A == A) {
+            return &isotopes->i[i];
         }
     }
     return NULL;
 }
 
 isotope_t *find_isotope_by_name(isotopes_t *isotopes, char *name) {
-    isotope_t *isotope;
-    int i;
-    for(i=0; i<isotopes->n_isotopes; i++) {
-        isotope=&isotopes->i[i];
-        if(strcmp(isotope->name, name) == 0) {
-            return isotope;
+    int slot, i;
+    for(slot=isotope_hash(name)&(isotopes->hash_size-1); (i=isotopes->name_hash[slot]) >= 0; slot=(slot+1)&(isotopes->hash_size-1)) {
+        if(strcmp(isotopes->i[i].name, name) == 0) {
+            return &isotopes->i[i];
         }
     }
     return NULL;
 }
 
 double velocity(double E, double mass) {
-    double gamma=1.0+E/(mass*SPEED_OF_LIGHT_SQUARED);
 #ifdef DEBUG
-    fprintf(stderr, "Relativistic gamma is %e (E=%e, mass=%e)\n", gamma, E, mass);
+    fprintf(stderr, "Relativistic gamma is %e (E=%e, mass=%e)\n", 1.0+E/(mass*SPEED_OF_LIGHT_SQUARED), E, mass);
 #endif
-    return sqrt((1-pow(gamma,-2.0))*SPEED_OF_LIGHT_SQUARED);
+    return gsto_velocity(E, mass);
 }
 
 double energy(double v, double mass) {
-    return (mass*SPEED_OF_LIGHT_SQUARED*(pow(1-pow(v/SPEED_OF_LIGHT,2.0),-0.5)-1));
+    return gsto_energy(v, mass);
 }
@@ -20,11 +20,29 @@ typedef struct {
     int A; /* A=Z+N */
     double mass;
     double abundance;
+    double mass_micro_u; /* Mass and abundance as given in masses.dat, for callers using their own constants */
+    double abundance_percent;
 } isotope_t;
 
+typedef struct {
+    int N;
+    int Z;
+    int A;
+    const char *symbol; /* "He" */
+    double mass; /* micro-u, as in masses.dat */
+    double abundance; /* %, as in masses.dat */
+} gsto_masses_entry_t;
+
 typedef struct {
     int n_isotopes;
-    isotope_t *i;
+    isotope_t *i; /* Sorted by Z, then A */
+    int Z_max;
+    int *Z_first; /* Isotopes of Z are i[Z_first[Z]] ... i[Z_first[Z+1]-1], Z=0..Z_max */
+    double *average_mass; /* average_mass[Z], weighted by natural abundance, 0 if Z has no natural isotopes */
+    isotope_t **most_abundant; /* most_abundant[Z] or NULL */
+    int hash_size; /* Power of two */
+    int *name_hash; /* Index to i by hash of the isotope name (e.g. "4-He"), -1 if empty */
+    int *symbol_hash; /* Z by hash of the element name (e.g. "He"), -1 if empty */
 } isotopes_t;
 
 typedef struct {
@@ -35,12 +53,16 @@ typedef struct {
     double *v; /* v=v[v_index] */
 } stopping_t;
 
+extern const gsto_masses_entry_t gsto_masses_builtin[]; /* Generated from masses.dat at build time, sorted by Z, then A */
+extern const int gsto_masses_builtin_n;
 
 double find_average_mass(isotopes_t *isotopes, int Z);
 int find_Z_by_name(isotopes_t *isotopes, char *name); 
 double find_mass(isotopes_t *isotope, int Z, int A); /* find isotope mass, but if A=0 calculate average mass of elem. */
 
-isotopes_t *load_isotope_table(char *filename);
+isotopes_t *load_isotope_table(char *filename); /* NULL for the compiled in table */
+isotopes_t *gsto_isotopes(void); /* Shared table of this process, loaded once on first call (not thread safe) from $GSTO_MASSES or the compiled in table */
+const char *find_symbol(isotopes_t *isotopes, int Z); /* "He" for Z=2, NULL if there is no such element */
 isotope_t *find_first_isotope(isotopes_t *isotopes, int Z);
 isotope_t *find_most_abundant_isotope(isotopes_t *isotopes, int Z);
 isotope_t *find_isotope(isotopes_t *isotopes, int Z, int A);
@@ -0,0 +1,206 @@
+/*
+    Range tables.
+
+    The range of an ion with mass m and energy E is
+
+        R(E) = integral dE/S(E) = m/e * integral v/S(v) dv,
+
+    so a single table of rho(v) = integral v/S(v) dv per ion and material
+    serves every isotope. Energies are in J, masses in kg, stopping in
+    eV/(1e15 at/cm^2) and ranges in 1e15 at/cm^2. Energy left after a layer
+    of thickness x is E(R(E)-x), i.e. two table lookups instead of stepping
+    through the layer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "libgsto.h"
+
+#define C_EV 1.6021917e-19 /* J */
+#define GSTO_RANGE_NEWTON_STEPS 3
+
+static double gsto_range_rho(const gsto_range_t *range, double v) { /* Cubic Hermite, the derivative of rho is known exactly at every point */
+    int i;
+    double h=range->v_max/(range->points-1);
+    double t=v/h, delta, m0, m1;
+    i=(int)t;
+    if(i > range->points-2)
+        i=range->points-2;
+    t -= i;
+    delta=range->rho[i+1]-range->rho[i];
+    m0=range->drho[i]*h;
+    m1=range->drho[i+1]*h;
+    return range->rho[i]+t*(m0+t*((3.0*delta-2.0*m0-m1)+t*(m0+m1-2.0*delta)));
+}
+
+static double gsto_range_drho(const gsto_range_t *range, double v) {
+    int i;
+    double t=v/range->v_max*(range->points-1);
+    i=(int)t;
+    if(i > range->points-2)
+        i=range->points-2;
+    t -= i;
+    return range->drho[i]+t*(range->drho[i+1]-range->drho[i]);
+}
+
+static double gsto_range_newton(const gsto_range_t *range, double rho, double v, double v_low, double v_high) { /* Refine v so that rho(v) = rho, staying between v_low and v_high */
+    int n;
+    for(n=0; n<GSTO_RANGE_NEWTON_STEPS; n++) {
+        v -= (gsto_range_rho(range, v)-rho)/gsto_range_drho(range, v);
+        if(v < v_low)
+            v=v_low;
+        if(v > v_high)
+            v=v_high;
+    }
+    return v;
+}
+
+static int gsto_range_resample_cached(gsto_resample_cache_t *cache, const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, const gsto_grid_t *grid, double *S) { /* Bragg's rule on stopping of each element resampled through cache. Mixtures whose fractions change, e.g. every depth of erd_depth, reuse the same cached combinations. */
+    int i, k;
+    double sum=0.0;
+    const double *cached;
+    for(i=0; i<mixture->n_elements; i++) {
+        sum += mixture->fractions[i];
+    }
+    if(sum <= 0.0)
+        return 0;
+    for(k=0; k<grid->points; k++) {
+        S[k]=0.0;
+    }
+    for(i=0; i<mixture->n_elements; i++) {
+        if(mixture->fractions[i] <= 0.0)
+            continue;
+        cached=gsto_resample_cached(cache, table, NULL, Z1, mixture->Z2[i], grid); /* Valid until the next lookup */
+        if(!cached)
+            return 0;
+        for(k=0; k<grid->points; k++) {
+            S[k] += mixture->fractions[i]/sum*cached[k];
+        }
+    }
+    return 1;
+}
+
+gsto_range_t *gsto_range_build(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double v_max, int points) { /* Integrate range of Z1 in mixture from v=0 to v_max */
+    return gsto_range_build_cached(NULL, table, mixture, Z1, v_max, points);
+}
+
+gsto_range_t *gsto_range_build_cached(gsto_resample_cache_t *cache, const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double v_max, int points) { /* Like gsto_range_build(), the stopping of each element is resampled through cache if it is not NULL */
+    int i, j, k, n, first=-1, success;
+    double h, u_step, rho, *S, *f;
+    gsto_grid_t grid;
+    gsto_range_t *range;
+    if(points < 2 || v_max <= 0.0) {
+        fprintf(stderr, "Range table needs at least two points and a positive v_max.\n");
+        return NULL;
+    }
+    n=2*points-1;
+    h=v_max/(points-1);
+    grid.unit=GSTO_GRID_V; /* Stopping at points and midpoints between them, v=k*h/2 */
+    grid.mass=0.0;
+    grid.x_min=0.0;
+    grid.x_max=v_max;
+    grid.points=n;
+    S=malloc(sizeof(double)*n);
+    f=malloc(sizeof(double)*n);
+    if(cache) {
+        success=gsto_range_resample_cached(cache, table, mixture, Z1, &grid, S);
+    } else {
+        success=gsto_mixture_resample(table, mixture, Z1, &grid, S);
+    }
+    for(k=0; k<n && success; k++) {
+        if(S[k] > 0.0) {
+            first=k;
+            break;
+        }
+    }
+    if(first < 0) {
+        fprintf(stderr, "No stopping for Z1=%i, can not calculate range.\n", Z1);
+        free(S);
+        free(f);
+        return NULL;
+    }
+    for(k=0; k<n; k++) {
+        if(k < first) { /* Below the table stopping is taken to be proportional to v, so v/S is constant */
+            f[k]=0.5*h*first/S[first];
+            continue;
+        }
+        if(S[k] <= 0.0) /* Above the table stopping is kept constant */
+            S[k]=S[k-1];
+        f[k]=0.5*h*k/S[k];
+    }
+    range=malloc(sizeof(gsto_range_t));
+    range->points=points;
+    range->v_max=v_max;
+    range->rho=malloc(sizeof(double)*points);
+    range->drho=malloc(sizeof(double)*points);
+    range->v=malloc(sizeof(double)*points);
+    range->rho[0]=0.0;
+    for(i=0; i<points; i++) {
+        range->drho[i]=f[2*i];
+        if(i)
+            range->rho[i]=range->rho[i-1]+h/6.0*(f[2*i-2]+4.0*f[2*i-1]+f[2*i]); /* Simpson's rule */
+    }
+    free(S);
+    free(f);
+    u_step=sqrt(range->rho[points-1])/(points-1);
+    range->v[0]=0.0;
+    for(i=0, j=1; j<points; j++) {
+        rho=(j*u_step)*(j*u_step);
+        while(i < points-2 && range->rho[i+1] < rho)
+            i++;
+        range->v[j]=gsto_range_newton(range, rho, h*(i+(rho-range->rho[i])/(range->rho[i+1]-range->rho[i])), h*i, h*(i+1));
+    }
+#ifdef DEBUG
+    fprintf(stderr, "Range table for Z1=%i, %i points up to v=%g m/s, rho_max=%g.\n", Z1, points, v_max, range->rho[points-1]);
+#endif
+    return range;
+}
+
+int gsto_range_deallocate(gsto_range_t *range) {
+    if(!range)
+        return 0;
+    free(range->rho);
+    free(range->drho);
+    free(range->v);
+    free(range);
+    return 1;
+}
+
+double gsto_range_R(const gsto_range_t *range, double mass, double E) { /* Range (1e15 at/cm^2) of an ion with mass (kg) and energy E (J), -1 if E is beyond the table */
+    double v;
+    if(E <= 0.0)
+        return 0.0;
+    v=sqrt(2.0*E/mass);
+    if(v > range->v_max)
+        return -1.0;
+    return mass*gsto_range_rho(range, v)/C_EV;
+}
+
+double gsto_range_E(const gsto_range_t *range, double mass, double R) { /* Inverse of gsto_range_R() */
+    int j;
+    double rho, u, u_step, t, v, h;
+    if(R <= 0.0)
+        return 0.0;
+    rho=R*C_EV/mass;
+    if(rho > range->rho[range->points-1])
+        return -1.0;
+    u=sqrt(rho);
+    u_step=sqrt(range->rho[range->points-1])/(range->points-1);
+    t=u/u_step;
+    j=(int)t;
+    if(j > range->points-2)
+        j=range->points-2;
+    v=range->v[j]+(t-j)*(range->v[j+1]-range->v[j]);
+    h=range->v_max/(range->points-1);
+    v=gsto_range_newton(range, rho, v, fmax(range->v[j]-h, 0.0), fmin(range->v[j+1]+h, range->v_max));
+    return 0.5*mass*v*v;
+}
+
+double gsto_range_E_after(const gsto_range_t *range, double mass, double E, double x) { /* Energy after thickness x (1e15 at/cm^2), negative x gives energy before. Zero if the ion stops, -1 if outside the table. */
+    double R=gsto_range_R(range, mass, E);
+    if(R < 0.0)
+        return -1.0;
+    return gsto_range_E(range, mass, R-x);
+}
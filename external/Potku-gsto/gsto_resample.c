@@ -0,0 +1,223 @@
+/*
+    Cache of stopping resampled to grids chosen by the caller.
+
+    gsto_resample() and gsto_mixture_resample() interpolate a combination or
+    a mixture at every point of a uniform grid in one sweep.
+    gsto_resample_cached() keeps the result, keyed on the combination or the
+    mixture composition, the grid and the stopping files (name, size and
+    modification time) it came from, for fused stopping each of its sources. If the cache has a directory, results
+    are also written there and later runs read them back instead of
+    resampling again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "libgsto.h"
+
+#define GSTO_RESAMPLE_KEY_LEN 256 /* Space for one element of the key, filename excluded */
+#define GSTO_RESAMPLE_CACHE_ENTRIES 64 /* Kept in memory, the oldest is replaced after this */
+
+static char *gsto_resample_key_append(char *key, const char *s) {
+    size_t len=key?strlen(key):0;
+    key=realloc(key, len+strlen(s)+1);
+    strcpy(key+len, s);
+    return key;
+}
+
+static char *gsto_resample_key_file(char *key, const gsto_file_t *file) { /* Name, size and modification time of the file stopping is read from */
+    char s[GSTO_RESAMPLE_KEY_LEN];
+    struct stat st;
+    if(stat(file->filename, &st) != 0) {
+        st.st_size=0;
+        st.st_mtime=0;
+    }
+    snprintf(s, sizeof(s), ",%lld,%lld,", (long long)st.st_size, (long long)st.st_mtime);
+    key=gsto_resample_key_append(key, s);
+    return gsto_resample_key_append(key, file->filename);
+}
+
+static char *gsto_resample_key_element(char *key, const gsto_table_t *table, int Z1, int Z2, double fraction) { /* Returns NULL (and frees key) if there is no stopping for Z1 in Z2 */
+    int id, i;
+    char s[GSTO_RESAMPLE_KEY_LEN];
+    const gsto_file_t *file, *source;
+    if(Z2 <= 0 || Z2 > table->Z2_max) {
+        free(key);
+        return NULL;
+    }
+    id=table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+    if(id < 0 && table->lazy) {
+        gsto_load_pair((gsto_table_t *)table, Z1, Z2);
+        id=table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+    }
+    if(id < 0) {
+        free(key);
+        return NULL;
+    }
+    file=table->pairs[id].file;
+    snprintf(s, sizeof(s), " Z2=%i,%.17g,%i,%.17g,%.17g,%i,%i,%i", Z2, fraction, file->xpoints, file->xmin, file->xmax, file->xscale, file->xunit, file->interpolation);
+    key=gsto_resample_key_append(key, s);
+    if(!file->fused)
+        return gsto_resample_key_file(key, file);
+    key=gsto_resample_key_append(key, ",fused ");
+    key=gsto_resample_key_append(key, file->name);
+    for(i=file-table->files+1; i<table->n_files; i++) { /* Fused, its sources are the files after it covering Z1 in Z2 (as in gsto_fuse_pair()) */
+        source=&table->files[i];
+        if(source->fused || source->xpoints < 2 || Z1 < source->Z1_min || Z1 > source->Z1_max || Z2 < source->Z2_min || Z2 > source->Z2_max)
+            continue;
+        snprintf(s, sizeof(s), " source=%i,%.17g,%.17g,%i,%i,%.17g,%.17g", source->xpoints, source->xmin, source->xmax, source->xscale, source->xunit, source->fuse_xmin, source->fuse_xmax);
+        key=gsto_resample_key_append(key, s);
+        key=gsto_resample_key_file(key, source);
+    }
+    return key;
+}
+
+static char *gsto_resample_key(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, int Z2, const gsto_grid_t *grid) {
+    int i;
+    char s[GSTO_RESAMPLE_KEY_LEN];
+    char *key=NULL;
+    if(Z1 <= 0 || Z1 > table->Z1_max)
+        return NULL;
+    snprintf(s, sizeof(s), "%s Z1=%i grid=%i,%.17g,%.17g,%.17g,%i storage=%i", mixture?"mixture":"pair", Z1, grid->unit, grid->mass, grid->x_min, grid->x_max, grid->points, table->storage);
+    key=gsto_resample_key_append(key, s);
+    if(!mixture)
+        return gsto_resample_key_element(key, table, Z1, Z2, 1.0);
+    for(i=0; i<mixture->n_elements && key; i++) {
+        key=gsto_resample_key_element(key, table, Z1, mixture->Z2[i], mixture->fractions[i]);
+    }
+    return key;
+}
+
+static uint64_t gsto_resample_hash(const char *key) { /* FNV-1a */
+    uint64_t hash=14695981039346656037ULL;
+    for(; *key; key++) {
+        hash ^= (unsigned char)*key;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static char *gsto_resample_filename(const gsto_resample_cache_t *cache, const char *key) {
+    size_t len=strlen(cache->directory)+32;
+    char *filename=malloc(len);
+    snprintf(filename, len, "%s/gsto-%016llx.sto", cache->directory, (unsigned long long)gsto_resample_hash(key));
+    return filename;
+}
+
+static double *gsto_resample_read(const gsto_resample_cache_t *cache, const char *key, int points) { /* Stopping from the cache directory, NULL if it isn't there */
+    uint64_t key_len;
+    char *filename, *file_key;
+    double *sto=NULL;
+    FILE *fp;
+    filename=gsto_resample_filename(cache, key);
+    fp=fopen(filename, "rb");
+    free(filename);
+    if(!fp)
+        return NULL;
+    if(fread(&key_len, sizeof(key_len), 1, fp) == 1 && key_len == strlen(key)) {
+        file_key=malloc(key_len);
+        sto=malloc(sizeof(double)*points);
+        if(fread(file_key, 1, key_len, fp) != key_len || memcmp(file_key, key, key_len) != 0 || fread(sto, sizeof(double), points, fp) != points) { /* Another grid with the same hash or a partially written file */
+            free(sto);
+            sto=NULL;
+        }
+        free(file_key);
+    }
+    fclose(fp);
+    return sto;
+}
+
+static int gsto_resample_write(const gsto_resample_cache_t *cache, const char *key, const double *sto, int points) {
+    uint64_t key_len=strlen(key);
+    int success;
+    char *filename=gsto_resample_filename(cache, key);
+    FILE *fp=fopen(filename, "wb");
+    if(!fp) {
+        fprintf(stderr, "GSTO: Could not write resampled stopping to %s.\n", filename);
+        free(filename);
+        return 0;
+    }
+    success=(fwrite(&key_len, sizeof(key_len), 1, fp) == 1 && fwrite(key, 1, key_len, fp) == key_len && fwrite(sto, sizeof(double), points, fp) == points);
+    fclose(fp);
+    if(!success)
+        remove(filename);
+    free(filename);
+    return success;
+}
+
+gsto_resample_cache_t *gsto_resample_cache_allocate(const char *directory) { /* directory may be NULL */
+    gsto_resample_cache_t *cache=malloc(sizeof(gsto_resample_cache_t));
+    cache->directory=directory?strdup(directory):NULL;
+    cache->n_entries=0;
+    cache->next=0;
+    cache->entries=calloc(GSTO_RESAMPLE_CACHE_ENTRIES, sizeof(gsto_resample_entry_t));
+    return cache;
+}
+
+int gsto_resample_cache_deallocate(gsto_resample_cache_t *cache) {
+    int i;
+    if(!cache)
+        return 0;
+    for(i=0; i<cache->n_entries; i++) {
+        free(cache->entries[i].key);
+        free(cache->entries[i].sto);
+    }
+    free(cache->entries);
+    free(cache->directory);
+    free(cache);
+    return 1;
+}
+
+const double *gsto_resample_cached(gsto_resample_cache_t *cache, const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, int Z2, const gsto_grid_t *grid) { /* Resampled stopping of Z1 in mixture (Z2 if mixture is NULL), owned by the cache and valid until it is replaced. NULL if there is no stopping. */
+    int i, success;
+    char *key;
+    double *sto;
+    gsto_resample_entry_t *entry;
+    if(grid->points < 1)
+        return NULL;
+    key=gsto_resample_key(table, mixture, Z1, Z2, grid);
+    if(!key) {
+        fprintf(stderr, "GSTO: No stopping to resample for Z1=%i.\n", Z1);
+        return NULL;
+    }
+    for(i=0; i<cache->n_entries; i++) {
+        if(strcmp(cache->entries[i].key, key) == 0) {
+            free(key);
+            return cache->entries[i].sto;
+        }
+    }
+    sto=cache->directory?gsto_resample_read(cache, key, grid->points):NULL;
+    if(!sto) {
+        sto=malloc(sizeof(double)*grid->points);
+        if(mixture)
+            success=gsto_mixture_resample(table, mixture, Z1, grid, sto);
+        else
+            success=gsto_resample(table, Z1, Z2, grid, sto);
+        if(!success) {
+            free(sto);
+            free(key);
+            return NULL;
+        }
+        if(cache->directory)
+            gsto_resample_write(cache, key, sto, grid->points);
+    }
+#ifdef DEBUG
+    else {
+        fprintf(stderr, "GSTO: Resampled stopping for Z1=%i read from %s.\n", Z1, cache->directory);
+    }
+#endif
+    if(cache->n_entries < GSTO_RESAMPLE_CACHE_ENTRIES) {
+        entry=&cache->entries[cache->n_entries++];
+    } else {
+        entry=&cache->entries[cache->next];
+        cache->next=(cache->next+1)%GSTO_RESAMPLE_CACHE_ENTRIES;
+        free(entry->key);
+        free(entry->sto);
+    }
+    entry->key=key;
+    entry->points=grid->points;
+    entry->sto=sto;
+    return sto;
+}
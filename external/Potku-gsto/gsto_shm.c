@@ -0,0 +1,498 @@
+/*
+    Images of loaded stopping: sharing between processes using POSIX shared
+    memory, and cache files.
+
+    An image is the whole loaded table in one block: a header, the file
+    descriptions, the loaded combinations and the arena. One process loads the
+    stopping as usual and publishes it with gsto_shm_publish(), other processes
+    attach to the segment read-only with gsto_shm_attach(). gsto_init_shm()
+    creates the segment before loading, so processes started at the same time
+    wait for the first one instead of all loading everything. gsto_cache_write()
+    stores the same image in a file, gsto_cache_load() maps it back. In both
+    cases the arena of the attached gsto_table_t points directly to the image,
+    so nothing is parsed or copied.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "libgsto.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#endif
+
+#define GSTO_IMAGE_MAGIC "GSTOIMG2"
+#define GSTO_IMAGE_NAME_LEN 64
+#define GSTO_IMAGE_FILENAME_LEN 1024
+#define GSTO_IMAGE_Z_MAX 1000 /* Anything larger is not an image written by us */
+#define GSTO_SHM_POLL_MS 5
+#define GSTO_SHM_WAIT_MS 10000 /* A segment not published in this time is taken to be abandoned by its creator */
+
+typedef struct {
+    char magic[8];
+    uint32_t ready; /* Set last by the publisher, attaching to an image that is not ready fails */
+    uint32_t Z1_max;
+    uint32_t Z2_max;
+    uint32_t n_files;
+    uint32_t n_pairs;
+    uint32_t storage;
+    uint64_t size; /* Size of the whole image in bytes */
+    uint64_t arena_offset; /* Offset of the arena from the beginning of the image */
+    uint64_t arena_points;
+} gsto_image_header_t;
+
+typedef struct {
+    int32_t Z1_min, Z1_max, Z2_min, Z2_max;
+    int32_t xpoints;
+    int32_t xscale, xunit, stounit, type, data_format, interpolation;
+    double xmin, xmax;
+    int64_t file_size; /* Size and modification time of the file when it was loaded, to detect stale images */
+    int64_t file_mtime;
+    char name[GSTO_IMAGE_NAME_LEN];
+    char filename[GSTO_IMAGE_FILENAME_LEN];
+} gsto_image_file_t;
+
+typedef struct {
+    int32_t Z1, Z2;
+    int32_t file; /* Index to files */
+    int32_t unused;
+    uint64_t offset; /* Offset of the data in the arena in points, like in gsto_pair_t */
+} gsto_image_pair_t;
+
+static gsto_image_file_t *gsto_image_files(gsto_image_header_t *header) {
+    return (gsto_image_file_t *)((char *)header+sizeof(gsto_image_header_t));
+}
+
+static gsto_image_pair_t *gsto_image_pairs(gsto_image_header_t *header) {
+    return (gsto_image_pair_t *)((char *)gsto_image_files(header)+sizeof(gsto_image_file_t)*header->n_files);
+}
+
+static size_t gsto_image_point_size(gsto_storage_t storage) {
+    return (storage == GSTO_STORAGE_FLOAT)?sizeof(float):sizeof(double);
+}
+
+static uint64_t gsto_image_arena_offset(const gsto_table_t *table) {
+    uint64_t offset=sizeof(gsto_image_header_t)+sizeof(gsto_image_file_t)*table->n_files+sizeof(gsto_image_pair_t)*table->n_pairs;
+    return (offset+7)/8*8; /* Arena is aligned to doubles */
+}
+
+static uint64_t gsto_image_size(const gsto_table_t *table) {
+    return gsto_image_arena_offset(table)+gsto_image_point_size(table->storage)*table->arena_points;
+}
+
+static void gsto_image_fill(const gsto_table_t *table, gsto_image_header_t *header) { /* header points to gsto_image_size(table) zeroed bytes. Everything but ready is filled. */
+    int i;
+    struct stat st;
+    gsto_image_file_t *f;
+    gsto_image_pair_t *pair;
+    const gsto_file_t *file;
+    memcpy(header->magic, GSTO_IMAGE_MAGIC, sizeof(header->magic));
+    header->Z1_max=table->Z1_max;
+    header->Z2_max=table->Z2_max;
+    header->n_files=table->n_files;
+    header->n_pairs=table->n_pairs;
+    header->storage=table->storage;
+    header->size=gsto_image_size(table);
+    header->arena_offset=gsto_image_arena_offset(table);
+    header->arena_points=table->arena_points;
+    f=gsto_image_files(header);
+    for(i=0; i<table->n_files; i++) {
+        file=&table->files[i];
+        f[i].Z1_min=file->Z1_min;
+        f[i].Z1_max=file->Z1_max;
+        f[i].Z2_min=file->Z2_min;
+        f[i].Z2_max=file->Z2_max;
+        f[i].xpoints=file->xpoints;
+        f[i].xscale=file->xscale;
+        f[i].xunit=file->xunit;
+        f[i].stounit=file->stounit;
+        f[i].type=file->type;
+        f[i].data_format=file->data_format;
+        f[i].interpolation=file->interpolation;
+        f[i].xmin=file->xmin;
+        f[i].xmax=file->xmax;
+        if(stat(file->filename, &st) == 0) {
+            f[i].file_size=st.st_size;
+            f[i].file_mtime=st.st_mtime;
+        }
+        strncpy(f[i].name, file->name, GSTO_IMAGE_NAME_LEN-1);
+        strncpy(f[i].filename, file->filename, GSTO_IMAGE_FILENAME_LEN-1);
+    }
+    pair=gsto_image_pairs(header);
+    for(i=0; i<table->n_pairs; i++) {
+        file=table->pairs[i].file;
+        pair[i].file=file-table->files;
+        pair[i].offset=table->pairs[i].offset;
+    }
+    for(i=0; i<(table->Z1_max+1)*(table->Z2_max+1); i++) { /* Pairs don't know their combination, pair_ids does */
+        if(table->pair_ids[i] < 0)
+            continue;
+        pair[table->pair_ids[i]].Z1=i/(table->Z2_max+1);
+        pair[table->pair_ids[i]].Z2=i%(table->Z2_max+1);
+    }
+    memcpy((char *)header+header->arena_offset, table->arena, gsto_image_point_size(table->storage)*table->arena_points);
+}
+
+static int gsto_image_bounds(gsto_image_header_t *header) { /* Every count, index and offset of the image stays within header->size */
+    uint32_t i;
+    uint64_t points;
+    gsto_image_file_t *f;
+    gsto_image_pair_t *pair;
+    if(header->Z1_max > GSTO_IMAGE_Z_MAX || header->Z2_max > GSTO_IMAGE_Z_MAX)
+        return 0;
+    if(sizeof(gsto_image_header_t)+sizeof(gsto_image_file_t)*(uint64_t)header->n_files+sizeof(gsto_image_pair_t)*(uint64_t)header->n_pairs > header->arena_offset)
+        return 0;
+    if(header->arena_offset%8 || header->arena_offset > header->size || header->arena_points > (header->size-header->arena_offset)/gsto_image_point_size(header->storage))
+        return 0;
+    f=gsto_image_files(header);
+    for(i=0; i<header->n_files; i++) {
+        if(f[i].xpoints <= 0 || !memchr(f[i].name, '\0', GSTO_IMAGE_NAME_LEN) || !memchr(f[i].filename, '\0', GSTO_IMAGE_FILENAME_LEN))
+            return 0;
+    }
+    pair=gsto_image_pairs(header);
+    for(i=0; i<header->n_pairs; i++) {
+        if(pair[i].file < 0 || pair[i].file >= header->n_files || pair[i].Z1 < 0 || pair[i].Z1 > header->Z1_max || pair[i].Z2 < 0 || pair[i].Z2 > header->Z2_max)
+            return 0;
+        points=f[pair[i].file].xpoints;
+        if(f[pair[i].file].interpolation == GSTO_INTERP_CUBIC && points >= 3) /* Slopes follow, as in gsto_store_pair() */
+            points *= 2;
+        if(pair[i].offset > header->arena_points || points > header->arena_points-pair[i].offset)
+            return 0;
+    }
+    return 1;
+}
+
+static int gsto_image_valid(gsto_image_header_t *header, uint64_t size, int exact, const char *name) { /* Check that the image is complete and that the stopping files have not changed since. Shared memory may be larger than the image (rounded to pages), files must be exact. */
+    int i;
+    struct stat st;
+    gsto_image_file_t *f;
+    if(size < sizeof(gsto_image_header_t) || memcmp(header->magic, GSTO_IMAGE_MAGIC, sizeof(header->magic)) != 0 || !header->ready || (exact?header->size != size:header->size > size) || header->storage >= GSTO_N_STORAGES || !gsto_image_bounds(header)) {
+        fprintf(stderr, "GSTO: Stopping image %s is not ready or not valid.\n", name);
+        return 0;
+    }
+    f=gsto_image_files(header);
+    for(i=0; i<header->n_files; i++) {
+        if(!f[i].filename[0]) /* Fused, its sources are checked */
+            continue;
+        if(stat(f[i].filename, &st) != 0 || st.st_size != f[i].file_size || st.st_mtime != f[i].file_mtime) {
+            fprintf(stderr, "GSTO: Stopping file %s has changed, stopping image %s is stale.\n", f[i].filename, name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static gsto_table_t *gsto_image_attach(gsto_image_header_t *header, int mapped) { /* Build a table around a valid image, the arena is not copied */
+    int i;
+    gsto_image_file_t *f;
+    gsto_image_pair_t *pair;
+    gsto_table_t *table;
+    gsto_file_t *file;
+    table=gsto_allocate(header->Z1_max, header->Z2_max);
+    table->files=calloc(header->n_files, sizeof(gsto_file_t));
+    table->n_files=header->n_files;
+    f=gsto_image_files(header);
+    for(i=0; i<header->n_files; i++) {
+        file=&table->files[i];
+        file->Z1_min=f[i].Z1_min;
+        file->Z1_max=f[i].Z1_max;
+        file->Z2_min=f[i].Z2_min;
+        file->Z2_max=f[i].Z2_max;
+        file->xpoints=f[i].xpoints;
+        file->xscale=f[i].xscale;
+        file->xunit=f[i].xunit;
+        file->stounit=f[i].stounit;
+        file->type=f[i].type;
+        file->data_format=f[i].data_format;
+        file->interpolation=f[i].interpolation;
+        file->xmin=f[i].xmin;
+        file->xmax=f[i].xmax;
+        file->name=strdup(f[i].name);
+        file->filename=strdup(f[i].filename);
+    }
+    table->pairs=calloc(header->n_pairs, sizeof(gsto_pair_t));
+    table->n_pairs=header->n_pairs;
+    table->pairs_allocated=header->n_pairs;
+    pair=gsto_image_pairs(header);
+    for(i=0; i<header->n_pairs; i++) {
+        file=&table->files[pair[i].file];
+        table->assigned_files[pair[i].Z1][pair[i].Z2]=file;
+        table->pair_ids[pair[i].Z1*(table->Z2_max+1)+pair[i].Z2]=i;
+        table->pairs[i].file=file;
+        table->pairs[i].offset=pair[i].offset;
+    }
+    table->storage=header->storage;
+    table->arena=(char *)header+header->arena_offset;
+    table->arena_points=header->arena_points;
+    table->arena_allocated=header->arena_points;
+    table->image=header;
+    table->image_size=header->size;
+    table->image_mapped=mapped;
+    return table;
+}
+
+int gsto_image_detach(gsto_table_t *table) { /* Release the image of an attached table, 0 if there is none */
+    if(!table->image)
+        return 0;
+#ifndef WIN32
+    if(table->image_mapped)
+        munmap(table->image, table->image_size);
+    else
+#endif
+        free(table->image);
+    table->image=NULL;
+    table->image_size=0;
+    table->arena=NULL;
+    return 1;
+}
+
+int gsto_cache_write(const gsto_table_t *table, const char *filename) { /* Store everything loaded to a cache file */
+    FILE *fp;
+    uint64_t size=gsto_image_size(table);
+    gsto_image_header_t *header=calloc(1, size);
+    if(!header)
+        return 0;
+    gsto_image_fill(table, header);
+    header->ready=1;
+    fp=fopen(filename, "wb");
+    if(!fp) {
+        fprintf(stderr, "GSTO: Could not open cache file %s for writing.\n", filename);
+        free(header);
+        return 0;
+    }
+    if(fwrite(header, 1, size, fp) != size) {
+        fprintf(stderr, "GSTO: Could not write cache file %s.\n", filename);
+        fclose(fp);
+        free(header);
+        remove(filename);
+        return 0;
+    }
+    fclose(fp);
+    free(header);
+#ifdef DEBUG
+    fprintf(stderr, "GSTO: Wrote %i combinations (%lu bytes) to cache file %s.\n", table->n_pairs, (unsigned long)size, filename);
+#endif
+    return 1;
+}
+
+gsto_table_t *gsto_cache_load(const char *filename) { /* Table from a cache file, NULL if there is no valid cache */
+    gsto_image_header_t *header;
+    struct stat st;
+#ifndef WIN32
+    int fd=open(filename, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(gsto_image_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    header=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED)
+        return NULL;
+    if(!gsto_image_valid(header, st.st_size, 1, filename)) {
+        munmap(header, st.st_size);
+        return NULL;
+    }
+    return gsto_image_attach(header, 1);
+#else
+    FILE *fp;
+    if(stat(filename, &st) != 0 || st.st_size < sizeof(gsto_image_header_t))
+        return NULL;
+    fp=fopen(filename, "rb");
+    if(!fp)
+        return NULL;
+    header=malloc(st.st_size);
+    if(fread(header, 1, st.st_size, fp) != st.st_size || !gsto_image_valid(header, st.st_size, 1, filename)) {
+        fclose(fp);
+        free(header);
+        return NULL;
+    }
+    fclose(fp);
+    return gsto_image_attach(header, 0);
+#endif
+}
+
+#ifndef WIN32
+
+static int gsto_shm_create(const char *shm_name) { /* Empty segment that nobody attaches to before it is ready, -1 (errno EEXIST) if it exists already */
+    return shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+}
+
+static int gsto_shm_fill(int fd, const gsto_table_t *table, const char *shm_name) { /* Image of table to a segment from gsto_shm_create(), removed again on failure */
+    uint64_t size=gsto_image_size(table);
+    gsto_image_header_t *header;
+    if(ftruncate(fd, size) != 0) {
+        fprintf(stderr, "GSTO: Could not resize shared memory segment %s to %lu bytes.\n", shm_name, (unsigned long)size);
+        close(fd);
+        shm_unlink(shm_name);
+        return 0;
+    }
+    header=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED) {
+        shm_unlink(shm_name);
+        return 0;
+    }
+    gsto_image_fill(table, header);
+    __sync_synchronize();
+    header->ready=1;
+    munmap(header, size);
+#ifdef DEBUG
+    fprintf(stderr, "GSTO: Published %i combinations (%lu bytes) to shared memory segment %s.\n", table->n_pairs, (unsigned long)size, shm_name);
+#endif
+    return 1;
+}
+
+static void gsto_shm_abandon(int fd, const char *shm_name) { /* Segment from gsto_shm_create() that will not be filled */
+    close(fd);
+    shm_unlink(shm_name);
+}
+
+static int gsto_shm_state(const char *shm_name) { /* -1 if there is no segment, 0 if it is still being published, 1 if it is ready */
+    int fd, ready;
+    struct stat st;
+    gsto_image_header_t *header;
+    fd=shm_open(shm_name, O_RDONLY, 0);
+    if(fd < 0)
+        return -1;
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(gsto_image_header_t)) {
+        close(fd);
+        return 0;
+    }
+    header=mmap(NULL, sizeof(gsto_image_header_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED)
+        return -1;
+    ready=((volatile gsto_image_header_t *)header)->ready;
+    munmap(header, sizeof(gsto_image_header_t));
+    return ready?1:0;
+}
+
+static gsto_table_t *gsto_shm_wait(const char *shm_name, int *fd) { /* Attach to the segment, waiting (bounded) while another process publishes it. If there is none, *fd is a new one for this process to publish, -1 if sharing is not possible. */
+    int state, waited=0;
+    gsto_table_t *table;
+    *fd=-1;
+    while(1) {
+        state=gsto_shm_state(shm_name);
+        if(state == 1) {
+            if((table=gsto_shm_attach(shm_name)))
+                return table;
+            if(gsto_shm_state(shm_name) == 1) /* Ready and not stale, but can not be attached */
+                return NULL;
+            continue; /* Stale, removed by gsto_shm_attach() */
+        }
+        if(state < 0) {
+            if((*fd=gsto_shm_create(shm_name)) >= 0 || errno != EEXIST)
+                return NULL;
+            continue; /* Another process created it first */
+        }
+        if(waited >= GSTO_SHM_WAIT_MS) {
+            fprintf(stderr, "GSTO: Shared memory segment %s was not published in %i ms, replacing it.\n", shm_name, GSTO_SHM_WAIT_MS);
+            shm_unlink(shm_name);
+            waited=0;
+            continue;
+        }
+        usleep(GSTO_SHM_POLL_MS*1000);
+        waited += GSTO_SHM_POLL_MS;
+    }
+}
+
+int gsto_shm_publish(const gsto_table_t *table, const char *shm_name) {
+    int fd=gsto_shm_create(shm_name);
+    if(fd < 0) {
+        fprintf(stderr, "GSTO: Could not create shared memory segment %s (error %i).\n", shm_name, errno);
+        return 0;
+    }
+    return gsto_shm_fill(fd, table, shm_name);
+}
+
+gsto_table_t *gsto_shm_attach(const char *shm_name) {
+    int fd;
+    struct stat st;
+    gsto_image_header_t *header;
+    fd=shm_open(shm_name, O_RDONLY, 0);
+    if(fd < 0) {
+        return NULL; /* Nobody has published yet */
+    }
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(gsto_image_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    header=mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED) {
+        return NULL;
+    }
+    if(!gsto_image_valid(header, st.st_size, 0, shm_name)) {
+        if(header->ready)
+            shm_unlink(shm_name); /* Stale, the next loader publishes a fresh copy */
+        munmap(header, st.st_size);
+        return NULL;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "GSTO: Attached to shared memory segment %s, %i combinations.\n", shm_name, (int)header->n_pairs);
+#endif
+    return gsto_image_attach(header, 1);
+}
+
+int gsto_shm_unlink(const char *shm_name) {
+    return (shm_unlink(shm_name) == 0);
+}
+
+#else /* No POSIX shared memory on Windows, every process loads its own copy. */
+
+static int gsto_shm_fill(int fd, const gsto_table_t *table, const char *shm_name) {
+    return 0;
+}
+
+static void gsto_shm_abandon(int fd, const char *shm_name) {
+}
+
+static gsto_table_t *gsto_shm_wait(const char *shm_name, int *fd) {
+    *fd=-1;
+    return NULL;
+}
+
+int gsto_shm_publish(const gsto_table_t *table, const char *shm_name) {
+    return 0;
+}
+
+gsto_table_t *gsto_shm_attach(const char *shm_name) {
+    return NULL;
+}
+
+int gsto_shm_unlink(const char *shm_name) {
+    return 0;
+}
+
+#endif
+
+gsto_table_t *gsto_init_shm(int Z_max, char *stoppings_file_name, const char *shm_name) { /* Attach to shared stopping if available, otherwise load everything and share it. Only the process creating the segment loads, the others wait for it. */
+    int fd;
+    gsto_table_t *table=gsto_shm_wait(shm_name, &fd);
+    if(table) {
+        return table;
+    }
+    table=gsto_init(Z_max, stoppings_file_name);
+    if(table) {
+        gsto_auto_assign_range(table, 1, Z_max, 1, Z_max); /* Other processes may need any combination */
+        if(!gsto_load(table)) {
+            gsto_deallocate(table);
+            table=NULL;
+        }
+    }
+    if(fd >= 0) {
+        if(table)
+            gsto_shm_fill(fd, table, shm_name); /* Failing here is not fatal, this process has the stopping anyway */
+        else
+            gsto_shm_abandon(fd, shm_name); /* Waiting processes try themselves */
+    }
+    return table;
+}
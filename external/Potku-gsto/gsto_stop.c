@@ -1,8 +1,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <libgsto.h>
 #include <gsto_masses.h>
+#ifndef WIN32
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DAEMON_MAX_CLIENTS 64
+#define DAEMON_BINARY_MAGIC "GSTB" /* First bytes sent by a client using binary requests */
+
+typedef struct { /* Binary request, answered with one double (eV/(1e15 at/cm^2)). Native byte order. */
+    int32_t Z1;
+    int32_t Z2;
+    double E; /* J */
+    double mass; /* kg */
+} gsto_stop_request_t;
+
+typedef struct {
+    int fd; /* -1 if the slot is free */
+    int binary; /* -1 until the first bytes are read */
+    size_t len;
+    char buffer[GSTO_MAX_LINE_LEN];
+} daemon_client_t;
+
+static volatile sig_atomic_t daemon_stop=0;
+#endif
 
 
 
@@ -10,45 +39,218 @@ int get_single_stop(gsto_table_t *table, isotope_t *incident, double E, int Z2)
     double v;
     v=velocity(E, incident->mass);
     fprintf(stderr, "Printing stopping for %i in %i at v=%e m/s from file %s.\n", incident->Z, Z2, v, table->assigned_files[incident->Z][Z2]->name);
-    printf("%e\n", gsto_sto_v(table, incident->Z, Z2, v));
+    printf("%e\n", gsto_sto_E(table, incident->Z, Z2, E, incident->mass));
     return 1; 
 }
 
-int main(int argc, char **argv) {
-    int Z2=0;
-    gsto_table_t *table;
-    isotopes_t *isotopes;
-    isotope_t *incident;
-    double E;
-    char *incident_name, *target_name, *E_unit_str;
-    if(argc != 4) {
-        fprintf(stderr, "Wrong number of arguments!\n");
-        return 0;
-    }
-    incident_name=argv[1]; /* E.g. 4-He */
-    target_name=argv[2]; /* E.g. Si */
-    E=strtod(argv[3], &E_unit_str);
+double parse_energy(char *E_str) { /* "2MeV", "2000keV" or J without a unit */
+    char *E_unit_str;
+    double E=strtod(E_str, &E_unit_str);
     if(strcmp(E_unit_str, "MeV")==0) {
         E *= MEV;
     }
     if(strcmp(E_unit_str, "keV")==0) {
         E *= KEV;
     }
-    isotopes=load_isotope_table(XSTR(DATAPATH/masses.dat));
+    return E;
+}
+
+int parse_query(isotopes_t *isotopes, char *incident_name, char *target_name, isotope_t **incident, int *Z2) {
+    *incident=find_isotope_by_name(isotopes, incident_name);
+    if(!*incident) {
+        fprintf(stderr, "No isotope %s found\n", incident_name);
+        return 0;
+    }
+    *Z2=find_Z_by_name(isotopes, target_name);
+    if(!*Z2) {
+        fprintf(stderr, "No element %s found\n", target_name);
+        return 0;
+    }
+    return 1;
+}
+
+double answer_line(gsto_table_t *table, isotopes_t *isotopes, char *line) { /* "4-He Si 2MeV", NAN if the line is not understood */
+    char incident_name[MAX_ELEMENT_NAME+1], target_name[MAX_ELEMENT_NAME+1], E_str[GSTO_MAX_LINE_LEN];
+    isotope_t *incident;
+    int Z2;
+    line[strcspn(line, "\r\n")]='\0';
+    if(sscanf(line, "%8s %8s %1023s", incident_name, target_name, E_str) != 3) {
+        fprintf(stderr, "Expected \"ion target energy\", got: %s\n", line);
+        return NAN;
+    }
+    if(!parse_query(isotopes, incident_name, target_name, &incident, &Z2))
+        return NAN;
+    return gsto_sto_E(table, incident->Z, Z2, parse_energy(E_str), incident->mass);
+}
+
+int run_batch(isotopes_t *isotopes, FILE *in, FILE *out) { /* One answer per line of input, combinations are loaded the first time they are needed */
+    char *line=malloc(sizeof(char)*GSTO_MAX_LINE_LEN);
+    gsto_table_t *table=gsto_init(91, XSTR(STOPPING_DATA));
+    if(!table)
+        return 0;
+    gsto_set_lazy(table, 1);
+    if(!gsto_load(table))
+        return 0;
+    while(fgets(line, GSTO_MAX_LINE_LEN, in) != NULL) {
+        if(*line == '#' || *line == '\n')
+            continue;
+        fprintf(out, "%e\n", answer_line(table, isotopes, line));
+    }
+    free(line);
+    gsto_deallocate(table);
+    return 1;
+}
+
+#ifndef WIN32
+static void daemon_signal(int sig) {
+    daemon_stop=1;
+}
+
+static int daemon_serve(gsto_table_t *table, isotopes_t *isotopes, daemon_client_t *client) { /* Answer complete requests in the buffer, 0 when the client is gone */
+    char reply[64];
+    char *end;
+    size_t used=0, len;
+    gsto_stop_request_t request;
+    double sto;
+    if(client->binary < 0) {
+        if(client->len < strlen(DAEMON_BINARY_MAGIC) && !memchr(client->buffer, '\n', client->len))
+            return 1;
+        client->binary=(client->len >= strlen(DAEMON_BINARY_MAGIC) && memcmp(client->buffer, DAEMON_BINARY_MAGIC, strlen(DAEMON_BINARY_MAGIC)) == 0);
+        if(client->binary)
+            used=strlen(DAEMON_BINARY_MAGIC);
+    }
+    if(client->binary) {
+        while(client->len-used >= sizeof(gsto_stop_request_t)) {
+            memcpy(&request, client->buffer+used, sizeof(gsto_stop_request_t));
+            used += sizeof(gsto_stop_request_t);
+            sto=gsto_sto_E(table, request.Z1, request.Z2, request.E, request.mass);
+            if(write(client->fd, &sto, sizeof(double)) != sizeof(double))
+                return 0;
+        }
+    } else {
+        while((end=memchr(client->buffer+used, '\n', client->len-used))) {
+            *end='\0';
+            snprintf(reply, sizeof(reply), "%e\n", answer_line(table, isotopes, client->buffer+used));
+            used=end-client->buffer+1;
+            len=strlen(reply);
+            if(write(client->fd, reply, len) != len)
+                return 0;
+        }
+        if(used == 0 && client->len == GSTO_MAX_LINE_LEN) { /* No newline in a full buffer */
+            fprintf(stderr, "Request too long, discarded.\n");
+            client->len=0;
+            return (write(client->fd, "nan\n", 4) == 4);
+        }
+    }
+    memmove(client->buffer, client->buffer+used, client->len-used);
+    client->len -= used;
+    return 1;
+}
+
+int run_daemon(isotopes_t *isotopes, char *socket_path) { /* Answers queries over a Unix domain socket until SIGINT or SIGTERM, the table stays loaded. Text clients send lines like -b, binary clients send DAEMON_BINARY_MAGIC followed by gsto_stop_request_t records. */
+    int i, n, listen_fd, fd;
+    ssize_t n_read;
+    struct sockaddr_un address;
+    struct pollfd fds[DAEMON_MAX_CLIENTS+1];
+    daemon_client_t *clients=malloc(sizeof(daemon_client_t)*DAEMON_MAX_CLIENTS);
+    gsto_table_t *table=gsto_init(91, XSTR(STOPPING_DATA));
+    if(!table)
+        return 0;
+    gsto_set_lazy(table, 1);
+    if(!gsto_load(table))
+        return 0;
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", socket_path);
+        return 0;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family=AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    listen_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path); /* Left behind by a daemon that did not exit cleanly */
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, DAEMON_MAX_CLIENTS) != 0) {
+        fprintf(stderr, "Could not listen on %s, error number %i.\n", socket_path, errno);
+        return 0;
+    }
+    signal(SIGINT, daemon_signal);
+    signal(SIGTERM, daemon_signal);
+    signal(SIGPIPE, SIG_IGN);
+    for(i=0; i<DAEMON_MAX_CLIENTS; i++) {
+        clients[i].fd=-1;
+    }
+    fprintf(stderr, "Listening on %s.\n", socket_path);
+    while(!daemon_stop) {
+        fds[0].fd=listen_fd;
+        fds[0].events=POLLIN;
+        for(i=0; i<DAEMON_MAX_CLIENTS; i++) {
+            fds[i+1].fd=clients[i].fd; /* Negative fds are ignored by poll() */
+            fds[i+1].events=POLLIN;
+            fds[i+1].revents=0;
+        }
+        n=poll(fds, DAEMON_MAX_CLIENTS+1, -1);
+        if(n < 0)
+            continue; /* EINTR, daemon_stop tells if we are done */
+        for(i=0; i<DAEMON_MAX_CLIENTS; i++) {
+            if(clients[i].fd < 0 || !(fds[i+1].revents & (POLLIN|POLLHUP|POLLERR)))
+                continue;
+            n_read=read(clients[i].fd, clients[i].buffer+clients[i].len, GSTO_MAX_LINE_LEN-clients[i].len);
+            if(n_read > 0) {
+                clients[i].len += n_read;
+                if(daemon_serve(table, isotopes, &clients[i]))
+                    continue;
+            }
+            close(clients[i].fd);
+            clients[i].fd=-1;
+        }
+        if(fds[0].revents & POLLIN) {
+            fd=accept(listen_fd, NULL, NULL);
+            for(i=0; fd >= 0 && i<DAEMON_MAX_CLIENTS && clients[i].fd >= 0; i++);
+            if(fd >= 0 && i == DAEMON_MAX_CLIENTS) {
+                fprintf(stderr, "Too many clients, connection refused.\n");
+                close(fd);
+            } else if(fd >= 0) {
+                clients[i].fd=fd;
+                clients[i].binary=-1;
+                clients[i].len=0;
+            }
+        }
+    }
+    for(i=0; i<DAEMON_MAX_CLIENTS; i++) {
+        if(clients[i].fd >= 0)
+            close(clients[i].fd);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    free(clients);
+    gsto_deallocate(table);
+    return 1;
+}
+#endif
+
+int main(int argc, char **argv) {
+    int Z2=0;
+    gsto_table_t *table;
+    isotopes_t *isotopes;
+    isotope_t *incident;
+    double E;
+    isotopes=gsto_isotopes(); /* Compiled in table unless overridden by $GSTO_MASSES */
     if(!isotopes) {
         fprintf(stderr, "Could not load isotope table.\n");
         return 0;
     }
-    incident=find_isotope_by_name(isotopes, incident_name);
-    if(!incident) {
-        fprintf(stderr, "No isotope %s found\n", incident_name);
+    if(argc == 2 && strcmp(argv[1], "-b") == 0) /* Queries from stdin */
+        return run_batch(isotopes, stdin, stdout);
+#ifndef WIN32
+    if(argc == 3 && strcmp(argv[1], "-d") == 0) /* Queries over a Unix domain socket */
+        return run_daemon(isotopes, argv[2]);
+#endif
+    if(argc != 4) {
+        fprintf(stderr, "Wrong number of arguments!\n");
         return 0;
     }
-    Z2=find_Z_by_name(isotopes, target_name);
-    if(!Z2) {
-        fprintf(stderr, "No element %s found\n", target_name);
+    E=parse_energy(argv[3]);
+    if(!parse_query(isotopes, argv[1], argv[2], &incident, &Z2)) /* E.g. 4-He Si */
         return 0;
-    }
     table=gsto_init(91, XSTR(STOPPING_DATA));
     gsto_auto_assign(table, incident->Z, Z2);
     gsto_load(table);
@@ -3,12 +3,11 @@
 #include <string.h>
 #include <math.h>
 #include "libgsto.h"
+#include "gsto_kinematics.h"
 #include "win_compat.h"
 
 #define C_KEV 1.6021917e-16 /* J */
 #define C_AMU 1.66044e-27 /* kg */
-#define C_C 2.9979246e+08 /* m/s */
-#define C_C2 8.9875518e+16 /* m^2/s^2 */
 
 #define STOPPING_DATA DATAPATH/stoppings.txt
 #define MASSES_DATA DATAPATH/masses.dat
@@ -39,12 +38,26 @@ static char *xscales[] = {
     "log10"
 };
 
+static char *interpolations[] = {
+    "none",
+    "linear",
+    "cubic"
+};
+
 static char *xunits[] = {
     "none",
     "m/s",
     "keV/u"
 };
 
+static char *gsto_errors[] = {
+    "no error",
+    "Z1 out of range",
+    "Z2 out of range",
+    "no stopping file assigned",
+    "x out of range of the table"
+};
+
 static char *gsto_headers[] = {
     "      ",
     "source",
@@ -58,7 +71,8 @@ static char *gsto_headers[] = {
     "x-min",
     "x-max",
     "x-points",
-    "x-scale"
+    "x-scale",
+    "interpolation"
 };
 
 int gsto_add_file(gsto_table_t *table, char *name, char *filename, int Z1_min, int Z1_max, int Z2_min, int Z2_max, char *type) {
@@ -69,8 +83,8 @@ int gsto_add_file(gsto_table_t *table, char *name, char *filename, int Z1_min, i
 #endif
     table->files = realloc(table->files, sizeof(gsto_file_t)*(table->n_files+1));
     gsto_file_t *new_file=&table->files[table->n_files];
-    new_file->name = calloc(strlen(name), sizeof(char));
-    new_file->filename = calloc(strlen(filename), sizeof(char));
+    new_file->name = calloc(strlen(name)+1, sizeof(char));
+    new_file->filename = calloc(strlen(filename)+1, sizeof(char));
     strcpy(new_file->name, name);
     strcpy(new_file->filename, filename);    
     for(i=GSTO_N_STOPPING_TYPES-1; i >=0; i--) {
@@ -91,6 +105,14 @@ int gsto_add_file(gsto_table_t *table, char *name, char *filename, int Z1_min, i
     new_file->xscale=0; /* and this */
     new_file->stounit=0;
     new_file->xunit=0;
+    new_file->interpolation=GSTO_INTERP_NONE; /* Table default unless the file says otherwise */
+    new_file->data_format=GSTO_DF_NONE;
+    new_file->xpoints=0;
+    new_file->data_offset=0;
+    new_file->block_offsets=NULL;
+    new_file->fused=0;
+    new_file->fuse_xmin=0.0;
+    new_file->fuse_xmax=0.0;
     if(Z1_min > Z1_max) {
         success=0;
     }
@@ -108,18 +130,50 @@ int gsto_add_file(gsto_table_t *table, char *name, char *filename, int Z1_min, i
     
 }
 
+int gsto_add_fused(gsto_table_t *table, char *name, int Z1_min, int Z1_max, int Z2_min, int Z2_max, int xpoints, char *type) { /* Stopping merged from the files added after this one. The grid spans all of them, log10 in keV/u. */
+    gsto_file_t *file;
+    if(xpoints < 2) {
+        fprintf(stderr, "Fused stopping %s needs at least two points.\n", name);
+        return 0;
+    }
+    if(!gsto_add_file(table, name, "", Z1_min, Z1_max, Z2_min, Z2_max, type)) {
+        return 0;
+    }
+    file=&table->files[table->n_files-1];
+    file->fused=1;
+    file->xpoints=xpoints;
+    file->xunit=GSTO_X_UNIT_KEV_U;
+    file->xscale=GSTO_XSCALE_LOG10;
+    file->stounit=GSTO_STO_UNIT_EV15CM2;
+    return 1;
+}
+
 gsto_table_t *gsto_allocate(int Z1_max, int Z2_max) {
-    int Z1;
+    int Z1, i;
     gsto_table_t *table = malloc(sizeof(gsto_table_t));
     table->Z1_max=Z1_max;
     table->Z2_max=Z2_max;
     table->n_files=0;
     table->files=NULL; /* These will be allocated by gsto_new_file */
+    table->interpolation=GSTO_INTERP_LINEAR;
+    table->lazy=0;
+    table->image=NULL;
+    table->image_size=0;
+    table->image_mapped=0;
+    table->n_pairs=0;
+    table->pairs_allocated=0;
+    table->pairs=NULL; /* These will be allocated by gsto_store_pair */
+    table->arena=NULL;
+    table->arena_points=0;
+    table->arena_allocated=0;
+    table->storage=GSTO_STORAGE_DOUBLE;
     table->assigned_files = (gsto_file_t ***)calloc(Z1_max+1, sizeof(gsto_file_t **));
-    table->ele = (double ***)calloc(Z2_max+1, sizeof(double *));
     for(Z1=0; Z1<=Z1_max; Z1++) {
             table->assigned_files[Z1] = (gsto_file_t **)calloc(Z2_max+1, sizeof(gsto_file_t *));
-            table->ele[Z1] = (double **)calloc(Z2_max+1, sizeof(double *));
+    }
+    table->pair_ids = (int *)malloc(sizeof(int)*(Z1_max+1)*(Z2_max+1));
+    for(i=0; i<(Z1_max+1)*(Z2_max+1); i++) {
+        table->pair_ids[i]=-1;
     }
     return table;
 }
@@ -132,14 +186,20 @@ int gsto_deallocate(gsto_table_t *table) {
     }
     for(i=0; i<table->n_files; i++) {
         file=&table->files[i];
+        free(file->block_offsets);
         /*free(file->filename);
         free(file->name);*/
     }
     /*free(table->files);*/
+    if(!gsto_image_detach(table)) { /* The arena of an attached table lives in the image */
+        free(table->arena);
+    }
     for(Z1=0; Z1<=table->Z1_max; Z1++) {
         free(table->assigned_files[Z1]);
-        free(table->ele[Z1]);
     }
+    free(table->assigned_files);
+    free(table->pair_ids);
+    free(table->pairs);
     free(table);
     return 1;
 }
@@ -149,28 +209,119 @@ int gsto_assign(gsto_table_t *table, int Z1, int Z2, gsto_file_t *file) { /* Use
     return 1;
 }
 
-int gsto_load_binary_file(gsto_table_t *table, gsto_file_t *file) {
+static int gsto_fuse_grid(const gsto_table_t *table, gsto_file_t *fused);
+static double *gsto_fuse_pair(const gsto_table_t *table, const gsto_file_t *fused, int Z1, int Z2);
+static int gsto_load_fused(gsto_table_t *table, gsto_file_t *fused);
+
+static int gsto_has_slopes(const gsto_file_t *file) {
+    return (file->interpolation == GSTO_INTERP_CUBIC && file->xpoints >= 3);
+}
+
+static const void *gsto_pair_data(const gsto_table_t *table, int id) { /* Stopping of a loaded combination, slopes follow if the file has them */
+    if(table->storage == GSTO_STORAGE_FLOAT)
+        return (const float *)table->arena+table->pairs[id].offset;
+    return (const double *)table->arena+table->pairs[id].offset;
+}
+
+static double gsto_value(const void *data, gsto_storage_t storage, int i) {
+    if(storage == GSTO_STORAGE_FLOAT)
+        return ((const float *)data)[i];
+    return ((const double *)data)[i];
+}
+
+static int gsto_reserve(gsto_table_t *table, size_t points) { /* Make room for points more in the arena */
+    size_t size=(table->storage == GSTO_STORAGE_FLOAT)?sizeof(float):sizeof(double);
+    size_t needed=table->arena_points+points;
+    void *arena;
+    if(needed <= table->arena_allocated)
+        return 1;
+    if(needed < 2*table->arena_allocated) /* Grow geometrically, so lazy loading doesn't reallocate on every combination */
+        needed=2*table->arena_allocated;
+    arena=realloc(table->arena, size*needed);
+    if(!arena)
+        return 0;
+    table->arena=arena;
+    table->arena_allocated=needed;
+    return 1;
+}
+
+int gsto_set_storage(gsto_table_t *table, gsto_storage_t storage) { /* Call before gsto_load() */
+    if(table->n_pairs || storage >= GSTO_N_STORAGES)
+        return 0;
+    table->storage=storage;
+    return 1;
+}
+
+int gsto_store_pair(gsto_table_t *table, int Z1, int Z2, const double *sto) { /* Copy stopping of a combination (on the grid of the assigned file) to the arena */
+    int i, id, n;
+    size_t offset;
+    double *slopes=NULL;
+    const gsto_file_t *file;
+    if (Z1 <= 0 || Z1 > table->Z1_max || Z2 <= 0 || Z2 > table->Z2_max || !table->assigned_files[Z1][Z2] || table->image)
+        return 0;
+    file=table->assigned_files[Z1][Z2];
+    n=file->xpoints;
+    id=table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+    if(id >= 0 && table->pairs[id].file == file) { /* Reloading, same grid, overwrite in place */
+        offset=table->pairs[id].offset;
+    } else {
+        if(!gsto_reserve(table, gsto_has_slopes(file)?2*n:n))
+            return 0;
+        if(table->n_pairs == table->pairs_allocated) {
+            table->pairs_allocated=table->pairs_allocated?2*table->pairs_allocated:64;
+            table->pairs=realloc(table->pairs, sizeof(gsto_pair_t)*table->pairs_allocated);
+        }
+        id=table->n_pairs++;
+        offset=table->arena_points;
+        table->arena_points += gsto_has_slopes(file)?2*n:n;
+        table->pairs[id].file=file;
+        table->pairs[id].offset=offset;
+        table->pair_ids[Z1*(table->Z2_max+1)+Z2]=id;
+    }
+    if(gsto_has_slopes(file)) {
+        slopes=gsto_monotone_slopes(sto, n);
+    }
+    for(i=0; i<n; i++) {
+        if(table->storage == GSTO_STORAGE_FLOAT) {
+            ((float *)table->arena)[offset+i]=sto[i];
+            if(slopes)
+                ((float *)table->arena)[offset+n+i]=slopes[i];
+        } else {
+            ((double *)table->arena)[offset+i]=sto[i];
+            if(slopes)
+                ((double *)table->arena)[offset+n+i]=slopes[i];
+        }
+    }
+    free(slopes);
+    return 1;
+}
+
+int gsto_load_binary_file(gsto_table_t *table, gsto_file_t *file, FILE *fp) {
     int Z1, Z2;
+    double *sto=malloc(sizeof(double)*file->xpoints);
 #ifdef DEBUG
     fprintf(stderr, "Loading binary data.\n");
 #endif
-    for (Z1=file->Z1_min; Z1<=file->Z1_max; Z1++) {
+    for (Z1=file->Z1_min; Z1<=file->Z1_max && Z1<=table->Z1_max; Z1++) {
         for (Z2=file->Z2_min; Z2<=file->Z2_max; Z2++) {
-            if (table->assigned_files[Z1][Z2] == file) {
-                table->ele[Z1][Z2] = malloc(sizeof(double)*file->xpoints);
-                fread(&table->ele[Z1][Z2], sizeof(double), file->xpoints, file->fp);
+            if (Z2 <= table->Z2_max && table->assigned_files[Z1][Z2] == file) {
+                fread(sto, sizeof(double), file->xpoints, fp);
+                gsto_store_pair(table, Z1, Z2, sto);
             } else {
-                fseek(file->fp, sizeof(double)*file->xpoints, SEEK_CUR);
+                fseek(fp, sizeof(double)*file->xpoints, SEEK_CUR);
             }
         }
     }
+    free(sto);
     return 1;
 }
 
-int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file) { 
+int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file, FILE *fp) { 
     int Z1, Z2, previous_Z1=file->Z1_min, previous_Z2=file->Z2_min-1, skip, i;
+    int lineno=0; /* Lines read after headers */
     char *line = calloc(GSTO_MAX_LINE_LEN, sizeof(char));
     int actually_skipped=0;
+    double *sto=malloc(sizeof(double)*file->xpoints);
 #ifdef DEBUG
     fprintf(stderr, "Loading ascii data.\n");
 #endif
@@ -185,14 +336,14 @@ int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file) {
 #endif
 
                 while (skip--) {
-                    file->lineno++;
-                    if(!fgets(line, GSTO_MAX_LINE_LEN, file->fp))
+                    lineno++;
+                    if(!fgets(line, GSTO_MAX_LINE_LEN, fp))
                         break;
                     
                     if(*line == '#') {
                         skip++; /* Undoing skip-- */
 #ifdef DEBUG
-                        fprintf(stderr, "Comment on line %i: %s", file->lineno, line+1);
+                        fprintf(stderr, "Comment on line %i after headers: %s", lineno, line+1);
 #endif
                     } 
                     actually_skipped++;
@@ -200,21 +351,21 @@ int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file) {
 #ifdef DEBUG
                 fprintf(stderr, "actually skipped %i lines\n", actually_skipped);
 #endif
-                table->ele[Z1][Z2] = malloc(sizeof(double)*file->xpoints);
                 for(i=0; i<file->xpoints; i++) {
-                    if(!fgets(line, GSTO_MAX_LINE_LEN, file->fp)) {
+                    if(!fgets(line, GSTO_MAX_LINE_LEN, fp)) {
 #ifdef DEBUG
                         fprintf(stderr, "File %s ended prematurely when reading Z1=%i Z2=%i stopping point=%i/%i.\n", file->filename, Z1, Z2, i+1, file->xpoints);
 #endif
                         break;
                     }
-                    file->lineno++;
+                    lineno++;
                     if(*line == '#') { /* This line is a comment. Ignore. */
                         i--;
                     } else {
-                        table->ele[Z1][Z2][i] = strtod(line, NULL);
+                        sto[i] = strtod(line, NULL);
                     }
                 }
+                gsto_store_pair(table, Z1, Z2, sto);
                 previous_Z1=Z1;
                 previous_Z2=Z2;
                 
@@ -222,119 +373,320 @@ int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file) {
         }
     }
     free(line);
+    free(sto);
     return 1;
 }
 
-int gsto_load(gsto_table_t *table) { /* For every file, load combinations from file */
+double *gsto_monotone_slopes(const double *data, int points) { /* Slopes (per point) for cubic Hermite interpolation. Central differences, limited so that monotone intervals stay monotone (Fritsch-Carlson). */
     int i;
-    gsto_file_t *file;
+    double limit, *delta, *m;
+    if(points < 3)
+        return NULL;
+    m = malloc(sizeof(double)*points);
+    delta = malloc(sizeof(double)*(points-1));
+    for(i=0; i<points-1; i++) {
+        delta[i]=data[i+1]-data[i];
+    }
+    m[0]=0.5*(-3.0*data[0]+4.0*data[1]-data[2]); /* Second order one-sided differences at the ends */
+    m[points-1]=0.5*(3.0*data[points-1]-4.0*data[points-2]+data[points-3]);
+    if(m[0]*delta[0] <= 0.0)
+        m[0]=0.0;
+    else if(fabs(m[0]) > 3.0*fabs(delta[0]))
+        m[0]=3.0*delta[0];
+    if(m[points-1]*delta[points-2] <= 0.0)
+        m[points-1]=0.0;
+    else if(fabs(m[points-1]) > 3.0*fabs(delta[points-2]))
+        m[points-1]=3.0*delta[points-2];
+    for(i=1; i<points-1; i++) {
+        if(delta[i-1]*delta[i] <= 0.0) { /* Extremum (or flat), a zero slope keeps the cubic from overshooting */
+            m[i]=0.0;
+            continue;
+        }
+        m[i]=0.5*(delta[i-1]+delta[i]);
+        limit=3.0*fmin(fabs(delta[i-1]), fabs(delta[i]));
+        if(fabs(m[i]) > limit) {
+            m[i]=copysign(limit, m[i]);
+        }
+    }
+    free(delta);
+    return m;
+}
+
+int gsto_set_interpolation(gsto_table_t *table, stopping_interpolation_t interpolation) { /* Default for files that don't have an interpolation header. Call before gsto_load(). */
+    if(interpolation == GSTO_INTERP_NONE || interpolation >= GSTO_N_INTERPOLATIONS) {
+        return 0;
+    }
+    table->interpolation=interpolation;
+    return 1;
+}
+
+static int gsto_load_headers(gsto_file_t *file, FILE *fp) { /* Parse headers, stop when end of headers found. Leaves fp at the beginning of the data. */
+    int lineno=0;
     char *line=calloc(GSTO_MAX_LINE_LEN, sizeof(char));
     char *line_split;
     char *columns[3];
     char **col;
     int header=0, property;
-    for(i=0; i<table->n_files; i++) {
-        file=&table->files[i];
-        file->fp=fopen(file->filename, "r");
-        if(!file->fp) {
-            fprintf(stderr, "Could not open file %s for reading.\n", file->filename);
-            return 0;
-        }
-        /* parse headers, stop when end of headers found */
-        while (fgets(line, GSTO_MAX_LINE_LEN, file->fp) != NULL) {
-            file->lineno++;
-            if(strncmp(line, GSTO_END_OF_HEADERS, strlen(GSTO_END_OF_HEADERS))==0) {
+    while (fgets(line, GSTO_MAX_LINE_LEN, fp) != NULL) {
+        lineno++;
+        if(strncmp(line, GSTO_END_OF_HEADERS, strlen(GSTO_END_OF_HEADERS))==0) {
 #ifdef DEBUG
-                fprintf(stderr, "End of headers on line %i of settings file.\n", file->lineno);
+            fprintf(stderr, "End of headers on line %i of settings file.\n", lineno);
 #endif
-                break;
-            }
-            line_split=line;
-            for (col = columns; (*col = strsep(&line_split, "=\n\r\t")) != NULL;)
-                if (**col != '\0')
-                    if (++col >= &columns[3])
-                        break;
+            break;
+        }
+        line_split=line;
+        for (col = columns; (*col = strsep(&line_split, "=\n\r\t")) != NULL;)
+            if (**col != '\0')
+                if (++col >= &columns[3])
+                    break;
 #ifdef DEBUG
-            fprintf(stderr, "Line %i, property %s is %s.\n", file->lineno, columns[0], columns[1]);
+        fprintf(stderr, "Line %i, property %s is %s.\n", lineno, columns[0], columns[1]);
 #endif 
-            for(header=0; header < GSTO_N_HEADER_TYPES; header++) {
+        for(header=0; header < GSTO_N_HEADER_TYPES; header++) {
 #ifdef DEBUG
-                fprintf(stderr, "Does \"%s\" match \"%s\"? ", columns[0], gsto_headers[header]);
+            fprintf(stderr, "Does \"%s\" match \"%s\"? ", columns[0], gsto_headers[header]);
 #endif
-                if(strncmp(columns[0], gsto_headers[header], strlen(gsto_headers[header]))==0) {
+            if(strncmp(columns[0], gsto_headers[header], strlen(gsto_headers[header]))==0) {
 #ifdef DEBUG
-                    fprintf(stderr, "Yes.\n");
+                fprintf(stderr, "Yes.\n");
 #endif
-                    switch (header) {
-                        case GSTO_HEADER_FORMAT:
-                            for(property=0; property<GSTO_N_STO_UNITS; property++) {
-                                if(strncmp(formats[property], columns[1], strlen(formats[property]))==0) {
-                                    file->data_format=property;
-                                }
+                switch (header) {
+                    case GSTO_HEADER_FORMAT:
+                        for(property=0; property<GSTO_N_DATA_FORMATS; property++) {
+                            if(strncmp(formats[property], columns[1], strlen(formats[property]))==0) {
+                                file->data_format=property;
                             }
-                            break;
-                        case GSTO_HEADER_STOUNIT:
-                            for(property=0; property<GSTO_N_STO_UNITS; property++) {
-                                if(strncmp(sto_units[property], columns[1], strlen(sto_units[property]))==0) {
-                                    file->stounit=property;
-                                }
+                        }
+                        break;
+                    case GSTO_HEADER_STOUNIT:
+                        for(property=0; property<GSTO_N_STO_UNITS; property++) {
+                            if(strncmp(sto_units[property], columns[1], strlen(sto_units[property]))==0) {
+                                file->stounit=property;
+                            }
+                        }
+                        break;
+                    case GSTO_HEADER_XSCALE:
+                        for(property=0; property<GSTO_N_X_SCALES; property++) {
+                            if(strncmp(xscales[property], columns[1], strlen(xscales[property]))==0) {
+                                file->xscale=property;
                             }
-                            break;
-                        case GSTO_HEADER_XSCALE:
-                            for(property=0; property<GSTO_N_X_SCALES; property++) {
-                                if(strncmp(xscales[property], columns[1], strlen(xscales[property]))==0) {
-                                    file->xscale=property;
-                                }
+                        }
+                        break;
+                    case GSTO_HEADER_INTERPOLATION:
+                        for(property=0; property<GSTO_N_INTERPOLATIONS; property++) {
+                            if(strncmp(interpolations[property], columns[1], strlen(interpolations[property]))==0) {
+                                file->interpolation=property;
                             }
-                            break;
-                        case GSTO_HEADER_XUNIT:
-                            for(property=0; property<GSTO_N_X_UNITS; property++) {
-                                if(strncmp(xunits[property], columns[1], strlen(xunits[property]))==0) {
-                                    file->xunit=property;
-                                }
+                        }
+                        break;
+                    case GSTO_HEADER_XUNIT:
+                        for(property=0; property<GSTO_N_X_UNITS; property++) {
+                            if(strncmp(xunits[property], columns[1], strlen(xunits[property]))==0) {
+                                file->xunit=property;
                             }
-                            break;
-                        case GSTO_HEADER_XPOINTS:
-                            file->xpoints=strtol(columns[1], NULL, 10);
+                        }
+                        break;
+                    case GSTO_HEADER_XPOINTS:
+                        file->xpoints=strtol(columns[1], NULL, 10);
 #ifdef DEBUG
-                            fprintf(stderr, "Set number of x points to %i\n", file->xpoints);
+                        fprintf(stderr, "Set number of x points to %i\n", file->xpoints);
 #endif
-                            break;
-                        case GSTO_HEADER_XMIN:
-                            file->xmin=strtod(columns[1], NULL);
+                        break;
+                    case GSTO_HEADER_XMIN:
+                        file->xmin=strtod(columns[1], NULL);
 #ifdef DEBUG
-                            fprintf(stderr, "Set minimum value of table to be %lf\n", file->xmin);
+                        fprintf(stderr, "Set minimum value of table to be %lf\n", file->xmin);
 #endif
-                            break;
-                        case GSTO_HEADER_XMAX:
-                            file->xmax=strtod(columns[1], NULL);
+                        break;
+                    case GSTO_HEADER_XMAX:
+                        file->xmax=strtod(columns[1], NULL);
 #ifdef DEBUG
-                            fprintf(stderr, "Set maximum value of table to be %lf\n", file->xmax);
+                        fprintf(stderr, "Set maximum value of table to be %lf\n", file->xmax);
 #endif
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                } else {
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            } else {
 #ifdef DEBUG
-                    fprintf(stderr, "No.\n");
+                fprintf(stderr, "No.\n");
 #endif
-                }
-            } 
+            }
+        } 
+    }
+    file->data_offset=ftell(fp);
+    free(line);
+    return 1;
+}
+
+int gsto_load(gsto_table_t *table) { /* For every file, load combinations from file. Lazy tables only get the headers here. */
+    int i, Z1, Z2;
+    size_t points=0;
+    gsto_file_t *file;
+    FILE *fp; /* Reading state is kept here and not in the table, the loaded table is only read after this */
+    for(i=0; i<table->n_files; i++) {
+        file=&table->files[i];
+        if(file->fused)
+            continue;
+        fp=fopen(file->filename, "r");
+        if(!fp) {
+            fprintf(stderr, "Could not open file %s for reading.\n", file->filename);
+            return 0;
+        }
+        gsto_load_headers(file, fp);
+        fclose(fp);
+        if(file->interpolation == GSTO_INTERP_NONE) {
+            file->interpolation=table->interpolation;
+        }
+    }
+    for(i=0; i<table->n_files; i++) { /* Grids of fused files need the headers of their sources */
+        file=&table->files[i];
+        if(file->fused && !gsto_fuse_grid(table, file)) {
+            fprintf(stderr, "No source files for fused stopping %s.\n", file->name);
+            return 0;
+        }
+    }
+    if(table->lazy) {
+        return 1;
+    }
+    for (Z1=1; Z1<=table->Z1_max; Z1++) { /* Everything assigned goes into the arena in one allocation */
+        for (Z2=1; Z2<=table->Z2_max; Z2++) {
+            file=table->assigned_files[Z1][Z2];
+            if(file && table->pair_ids[Z1*(table->Z2_max+1)+Z2] < 0)
+                points += gsto_has_slopes(file)?2*file->xpoints:file->xpoints;
+        }
+    }
+    if(!gsto_reserve(table, points)) {
+        fprintf(stderr, "Could not allocate memory for stopping.\n");
+        return 0;
+    }
+    for(i=0; i<table->n_files; i++) {
+        file=&table->files[i];
+        if(file->fused) {
+            gsto_load_fused(table, file);
+            continue;
+        }
+        fp=fopen(file->filename, "r");
+        if(!fp) {
+            fprintf(stderr, "Could not open file %s for reading.\n", file->filename);
+            return 0;
         }
+        fseek(fp, file->data_offset, SEEK_SET);
         switch (file->data_format) {
             case GSTO_DF_DOUBLE:
-                gsto_load_binary_file(table, file);
+                gsto_load_binary_file(table, file, fp);
                 break;
             case GSTO_DF_ASCII:
             default:
-                gsto_load_ascii_file(table, file);
+                gsto_load_ascii_file(table, file, fp);
                 break;
         }
-        fclose(file->fp);
+        fclose(fp);
+    }
+    return 1;
+}
+
+int gsto_set_lazy(gsto_table_t *table, int lazy) { /* Call before gsto_load(). Combinations are then assigned and loaded by the first lookup. */
+    table->lazy=lazy;
+    return 1;
+}
+
+static int gsto_index_ascii_file(gsto_file_t *file, FILE *fp) { /* Find where each Z1, Z2 block starts, so later blocks can be read without parsing earlier ones */
+    int n_blocks=(file->Z1_max-file->Z1_min+1)*(file->Z2_max-file->Z2_min+1);
+    int n=0;
+    long position;
+    char *line=calloc(GSTO_MAX_LINE_LEN, sizeof(char));
+    file->block_offsets=calloc(n_blocks, sizeof(long));
+    fseek(fp, file->data_offset, SEEK_SET);
+    while(position=ftell(fp), fgets(line, GSTO_MAX_LINE_LEN, fp) && n < n_blocks*file->xpoints) {
+        if(*line == '#')
+            continue;
+        if(n % file->xpoints == 0)
+            file->block_offsets[n/file->xpoints]=position;
+        n++;
     }
     free(line);
+#ifdef DEBUG
+    fprintf(stderr, "Indexed %i blocks of file %s.\n", n/file->xpoints, file->filename);
+#endif
+    return (n == n_blocks*file->xpoints);
+}
+
+static double *gsto_read_pair(gsto_file_t *file, int Z1, int Z2) { /* Stopping of a single combination straight from the file, NULL on failure */
+    int i, block, success=1;
+    FILE *fp;
+    char *line;
+    double *sto;
+    fp=fopen(file->filename, "r");
+    if(!fp) {
+        fprintf(stderr, "Could not open file %s for reading.\n", file->filename);
+        return NULL;
+    }
+    block=(Z1-file->Z1_min)*(file->Z2_max-file->Z2_min+1)+(Z2-file->Z2_min);
+    sto=malloc(sizeof(double)*file->xpoints);
+    switch (file->data_format) {
+        case GSTO_DF_DOUBLE:
+            fseek(fp, file->data_offset+sizeof(double)*file->xpoints*block, SEEK_SET);
+            success=(fread(sto, sizeof(double), file->xpoints, fp) == file->xpoints);
+            break;
+        case GSTO_DF_ASCII:
+        default:
+            if(!file->block_offsets && !gsto_index_ascii_file(file, fp)) {
+                fprintf(stderr, "File %s ended prematurely.\n", file->filename);
+            }
+            if(!file->block_offsets[block]) { /* Block is beyond the end of the file */
+                success=0;
+                break;
+            }
+            line=calloc(GSTO_MAX_LINE_LEN, sizeof(char));
+            fseek(fp, file->block_offsets[block], SEEK_SET);
+            for(i=0; i<file->xpoints && fgets(line, GSTO_MAX_LINE_LEN, fp);) {
+                if(*line != '#')
+                    sto[i++]=strtod(line, NULL);
+            }
+            free(line);
+            break;
+    }
+    fclose(fp);
+    if(!success) {
+        free(sto);
+        return NULL;
+    }
+    return sto;
+}
+
+int gsto_load_pair(gsto_table_t *table, int Z1, int Z2) { /* Assign (if necessary) and load stopping of a single combination */
+    int success;
+    gsto_file_t *file;
+    double *sto;
+    if (Z1 <= 0 || Z1 > table->Z1_max || Z2 <= 0 || Z2 > table->Z2_max)
+        return 0;
+    if(table->pair_ids[Z1*(table->Z2_max+1)+Z2] >= 0)
+        return 1;
+    if(!table->assigned_files[Z1][Z2] && !gsto_auto_assign(table, Z1, Z2))
+        return 0;
+    file=table->assigned_files[Z1][Z2];
+    if(file->xpoints <= 0 || (file->fused && file->xmax <= 0.0)) {
+        fprintf(stderr, "Headers of file %s not loaded, call gsto_load() first.\n", file->filename);
+        return 0;
+    }
+    if(file->fused)
+        sto=gsto_fuse_pair(table, file, Z1, Z2);
+    else
+        sto=gsto_read_pair(file, Z1, Z2);
+    if(!sto) {
+        return 0;
+    }
+    success=gsto_store_pair(table, Z1, Z2, sto);
+    free(sto);
+    if(!success) {
+        return 0;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "Loaded Z1=%i Z2=%i from file %s.\n", Z1, Z2, file->name);
+#endif
     return 1;
 }
 
@@ -354,7 +706,7 @@ int gsto_print_files(gsto_table_t *table) {
                 }
             }        
         }
-        fprintf(stderr, "%i: %s (%s), %i assignments, %i<=Z1<=%i, %i<=Z2<=%i. x-points=%i, x-scale=%s, x-unit=%s, stopping unit=%s, format=%s\n", i, file->name, file->filename, assignments, file->Z1_min, file->Z1_max, file->Z2_min, file->Z2_max, file->xpoints, xscales[file->xscale], xunits[file->xunit], sto_units[file->stounit], formats[file->data_format]);  
+        fprintf(stderr, "%i: %s (%s), %i assignments, %i<=Z1<=%i, %i<=Z2<=%i. x-points=%i, x-scale=%s, interpolation=%s, x-unit=%s, stopping unit=%s, format=%s\n", i, file->name, file->filename, assignments, file->Z1_min, file->Z1_max, file->Z2_min, file->Z2_max, file->xpoints, xscales[file->xscale], interpolations[file->interpolation], xunits[file->xunit], sto_units[file->stounit], formats[file->data_format]);  
     }
     fprintf(stderr, "=====\n");
     return 1;
@@ -410,8 +762,9 @@ gsto_table_t *gsto_init(int Z_max, char *stoppings_file_name) {
     int i=0, n_files=0, n_errors=0;
     char *line=calloc(GSTO_MAX_LINE_LEN, sizeof(char));
     char *line_split;
-    char *columns[8];
+    char *columns[10];
     char **col;
+    int success;
     FILE *settings_file=NULL;
     gsto_table_t *table;
     table = gsto_allocate(Z_max, Z_max); /* Allocate memory for assignment table, initialize some variables */
@@ -428,11 +781,21 @@ gsto_table_t *gsto_init(int Z_max, char *stoppings_file_name) {
             if(line[0] == '#') /* Strip comments */
                 continue;
             line_split=line; /* strsep will screw up line_split, reset for every new line */
+            memset(columns, 0, sizeof(columns));
             for (col = columns; (*col = strsep(&line_split, " \t\r\n")) != NULL;)
                 if (**col != '\0')
-                    if (++col >= &columns[8])
+                    if (++col >= &columns[10])
                         break;
-            if(gsto_add_file(table, columns[7], columns[0], strtol(columns[2], NULL, 10), strtol(columns[3], NULL, 10), strtol(columns[4], NULL, 10), strtol(columns[5], NULL, 10), columns[1])) {
+            if(strcmp(columns[0], "fused") == 0) { /* Format column is the number of points for fused stopping */
+                success=gsto_add_fused(table, columns[7], strtol(columns[2], NULL, 10), strtol(columns[3], NULL, 10), strtol(columns[4], NULL, 10), strtol(columns[5], NULL, 10), strtol(columns[6], NULL, 10), columns[1]);
+            } else {
+                success=gsto_add_file(table, columns[7], columns[0], strtol(columns[2], NULL, 10), strtol(columns[3], NULL, 10), strtol(columns[4], NULL, 10), strtol(columns[5], NULL, 10), columns[1]);
+            }
+            if(success) {
+                if(columns[8] && columns[9]) { /* Optional preferred range (keV/u) for fusing */
+                    table->files[table->n_files-1].fuse_xmin=strtod(columns[8], NULL);
+                    table->files[table->n_files-1].fuse_xmax=strtod(columns[9], NULL);
+                }
                 n_files++;
             } else {
                 n_errors++;
@@ -449,7 +812,8 @@ gsto_table_t *gsto_init(int Z_max, char *stoppings_file_name) {
     return table;
 }
 
-double gsto_sto_raw(gsto_table_t *table, int Z1, int Z2, int point_number) {
+double gsto_sto_raw(const gsto_table_t *table, int Z1, int Z2, int point_number) {
+    int id;
     if (Z1 <= 0 || Z1 > table->Z1_max) {
         fprintf(stderr, "Z1=%i out of range!\n", Z1);
         return 0;
@@ -458,66 +822,64 @@ double gsto_sto_raw(gsto_table_t *table, int Z1, int Z2, int point_number) {
         fprintf(stderr, "Z2=%i out of range!\n", Z2);
         return 0;
     }
-    /* Now Z1 and Z2 should be sane, let's check if point_number is */
-    if(point_number <= 0 || point_number >= table->assigned_files[Z1][Z2]->xpoints) {
-        fprintf(stderr, "Stopping point = %i out of range!\n", point_number);
-        return 0;
+    id=table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+    if(table->lazy && id < 0) {
+        gsto_load_pair((gsto_table_t *)table, Z1, Z2);
+        id=table->pair_ids[Z1*(table->Z2_max+1)+Z2];
     }
     /* No stopping loaded */
-    if(table->assigned_files[Z1][Z2] == NULL) {
+    if(id < 0) {
         fprintf(stderr, "No stopping file assigned to Z1=%i Z2=%i\n", Z1, Z2);
         return 0;
     }
+    /* Now Z1 and Z2 should be sane, let's check if point_number is */
+    if(point_number < 0 || point_number >= table->pairs[id].file->xpoints) {
+        fprintf(stderr, "Stopping point = %i out of range!\n", point_number);
+        return 0;
+    }
     /* Sanity checked, just return the value */
-    return table->ele[Z1][Z2][point_number];
+    return gsto_value(gsto_pair_data(table, id), table->storage, point_number);
 }
 
-double gsto_sto_v(gsto_table_t *table, int Z1, int Z2, double v) { /* Simplest way to access stopping data */
-    int i;
-    double i_float, x, gamma, sto_low, sto_high, sto;
-    gsto_file_t *file;
-    if (Z1 <= 0 || Z1 > table->Z1_max) {
-        fprintf(stderr, "Z1=%i out of range!\n", Z1);
-        return 0;
-    }
-    if (Z2 <= 0 || Z2 > table->Z2_max) {
-        fprintf(stderr, "Z2=%i out of range!\n", Z2);
-        return 0;
-    }
-    /* Now Z1 and Z2 should be sane */
-    file = table->assigned_files[Z1][Z2];
-    /* No stopping loaded */
-    if(table->assigned_files[Z1][Z2] == NULL) {
-        fprintf(stderr, "No stopping file assigned to Z1=%i Z2=%i\n", Z1, Z2);
-        return 0;
-    }
-    
-    
-    /* Scale v to "native" velocity, i.e. units of the file. */
+static double gsto_v_to_x(const gsto_file_t *file, double v) { /* Scale v to "native" velocity, i.e. units of the file. */
     switch (file->xunit) {
         case GSTO_X_UNIT_KEV_U:
-            gamma=1.0/(sqrt(1-pow(v,2.0)/C_C2));
-            x=(gamma-1)*C_C2/(C_KEV/C_AMU);
+            return gsto_energy(v, C_AMU)/C_KEV;
             /* x=0.5*1.0363554e-11*pow(v,2.0);*/ /* conversion from m/s to keV/amu (classical) */
-            break;
         case GSTO_X_UNIT_M_S:
         default:
-            x=v;
-            break;
+            return v;
     }
-    if(x <= file->xmin) {
-#ifdef DEBUG
-        fprintf(stderr, "Velocity out of range (too low, requested %e, min %e)!\n", x, file->xmin);
-#endif
-        return 0.0;
-        return table->ele[Z1][Z2][0];
+}
+
+static double gsto_x_to_v(const gsto_file_t *file, double x) { /* Inverse of gsto_v_to_x() */
+    switch (file->xunit) {
+        case GSTO_X_UNIT_KEV_U:
+            return gsto_velocity(x*C_KEV, C_AMU);
+        case GSTO_X_UNIT_M_S:
+        default:
+            return x;
     }
-    if(x >= file->xmax) {
-#ifdef DEBUG
-        fprintf(stderr, "Velocity out of range (too high, requested %e, max %e)!\n", x, file->xmax);
-#endif
+}
+
+static double gsto_file_x(const gsto_file_t *file, int point_number) { /* x value of a tabulated point */
+    double f=1.0*point_number/(file->xpoints-1);
+    switch (file->xscale) {
+        case GSTO_XSCALE_LOG10:
+            return file->xmin*pow(file->xmax/file->xmin, f);
+        case GSTO_XSCALE_LINEAR:
+        default:
+            return file->xmin+(file->xmax-file->xmin)*f;
+    }
+}
+
+static double gsto_interpolate(const gsto_file_t *file, const void *data, gsto_storage_t storage, double x, gsto_error_t *error) { /* Interpolate tabulated data (on the grid of file) at native x. Cubic if the file has slopes, they follow the data. */
+    int i, n=file->xpoints;
+    double i_float, t, sto_low, sto_high, delta, m0, m1;
+    if(x <= file->xmin || x >= file->xmax) {
+        if(error)
+            *error=GSTO_ERR_X_OUT_OF_RANGE;
         return 0.0;
-        return table->ele[Z1][Z2][file->xpoints-1];
     }
 
     /* Apply scaling of x to indices of tabulated stopping */
@@ -532,13 +894,252 @@ double gsto_sto_v(gsto_table_t *table, int Z1, int Z2, double v) { /* Simplest w
             break;
     }
     i = (int) floor(i_float);
-    sto_low = table->ele[Z1][Z2][i];
-    sto_high = table->ele[Z1][Z2][i+1];
-    sto = ((sto_high-sto_low)*(i_float-1.0*i))+sto_low;
+    t = i_float-1.0*i;
+    sto_low = gsto_value(data, storage, i);
+    sto_high = gsto_value(data, storage, i+1);
+    if(gsto_has_slopes(file)) { /* Cubic Hermite, t in [0,1] between points i and i+1 */
+        delta = sto_high-sto_low;
+        m0 = gsto_value(data, storage, n+i);
+        m1 = gsto_value(data, storage, n+i+1);
+        return sto_low+t*(m0+t*((3.0*delta-2.0*m0-m1)+t*(m0+m1-2.0*delta)));
+    }
+    return ((sto_high-sto_low)*t)+sto_low;
+}
+
+static int gsto_fuse_source(const gsto_file_t *fused, const gsto_file_t *file, int Z1, int Z2) { /* Can file contribute to fused stopping of Z1 in Z2 (or any Z1, Z2 of fused if Z1=0)? */
+    if(file->fused || file->xpoints < 2)
+        return 0;
+    if(!Z1)
+        return (file->Z1_min <= fused->Z1_max && file->Z1_max >= fused->Z1_min && file->Z2_min <= fused->Z2_max && file->Z2_max >= fused->Z2_min);
+    return (file->Z1_min <= Z1 && file->Z1_max >= Z1 && file->Z2_min <= Z2 && file->Z2_max >= Z2);
+}
+
+static int gsto_fuse_grid(const gsto_table_t *table, gsto_file_t *fused) { /* The grid of fused stopping spans all of its sources */
+    int i;
+    double xmin=0.0, xmax=0.0, x;
+    const gsto_file_t *file;
+    for(i=fused-table->files+1; i<table->n_files; i++) {
+        file=&table->files[i];
+        if(!gsto_fuse_source(fused, file, 0, 0))
+            continue;
+        x=gsto_v_to_x(fused, gsto_x_to_v(file, file->xmin));
+        if(x > 0.0 && (xmin <= 0.0 || x < xmin))
+            xmin=x;
+        x=gsto_v_to_x(fused, gsto_x_to_v(file, file->xmax));
+        if(x > xmax)
+            xmax=x;
+    }
+    if(xmin <= 0.0 || xmax <= xmin)
+        return 0;
+    fused->xmin=xmin;
+    fused->xmax=xmax;
+    if(fused->interpolation == GSTO_INTERP_NONE)
+        fused->interpolation=table->interpolation;
+    return 1;
+}
+
+static int gsto_fuse_value(const gsto_file_t *file, const double *data, double v, double *sto) { /* Stopping from a source at v, 0 if v is not covered by it. The ends of the table are included. */
+    double x=gsto_v_to_x(file, v);
+    if(x < file->xmin*(1.0-1e-9) || x > file->xmax*(1.0+1e-9)) /* Tolerance for the unit conversion round trip */
+        return 0;
+    if(x <= file->xmin)
+        *sto=data[0];
+    else if(x >= file->xmax)
+        *sto=data[file->xpoints-1];
+    else
+        *sto=gsto_interpolate(file, data, GSTO_STORAGE_DOUBLE, x, NULL);
+    return 1;
+}
+
+static double *gsto_fuse_pair(const gsto_table_t *table, const gsto_file_t *fused, int Z1, int Z2) { /* Stopping on the grid of fused. Each point comes from the first source (in the order of files) preferring that energy, or failing that from the first covering it. */
+    int i, j, pass, n_sources=0, first=fused-table->files+1;
+    double x, v, *slopes, *sto, **data;
+    const gsto_file_t *file;
+    data=calloc(table->n_files, sizeof(double *));
+    for(j=first; j<table->n_files; j++) {
+        file=&table->files[j];
+        if(!gsto_fuse_source(fused, file, Z1, Z2) || !(data[j]=gsto_read_pair(&table->files[j], Z1, Z2)))
+            continue;
+        n_sources++;
+        if(gsto_has_slopes(file)) { /* Slopes follow the data, like in the arena */
+            slopes=gsto_monotone_slopes(data[j], file->xpoints);
+            data[j]=realloc(data[j], 2*sizeof(double)*file->xpoints);
+            memcpy(data[j]+file->xpoints, slopes, sizeof(double)*file->xpoints);
+            free(slopes);
+        }
+    }
+    if(!n_sources) {
+        free(data);
+        return NULL;
+    }
+    sto=calloc(fused->xpoints, sizeof(double));
+    for(i=0; i<fused->xpoints; i++) {
+        x=gsto_file_x(fused, i);
+        v=gsto_x_to_v(fused, x);
+        for(pass=0; pass<2; pass++) {
+            for(j=first; j<table->n_files; j++) {
+                file=&table->files[j];
+                if(!data[j])
+                    continue;
+                if(!pass && (x < file->fuse_xmin || (file->fuse_xmax > 0.0 && x >= file->fuse_xmax)))
+                    continue;
+                if(gsto_fuse_value(file, data[j], v, &sto[i]))
+                    break;
+            }
+            if(j < table->n_files)
+                break;
+        }
+    }
+    for(j=first; j<table->n_files; j++) {
+        free(data[j]);
+    }
+    free(data);
+#ifdef DEBUG
+    fprintf(stderr, "Fused Z1=%i Z2=%i from %i files to %s.\n", Z1, Z2, n_sources, fused->name);
+#endif
+    return sto;
+}
+
+static int gsto_load_fused(gsto_table_t *table, gsto_file_t *fused) { /* Like gsto_load_ascii_file() for a fused file */
+    int Z1, Z2;
+    double *sto;
+    for (Z1=fused->Z1_min; Z1<=fused->Z1_max && Z1<=table->Z1_max; Z1++) {
+        for (Z2=fused->Z2_min; Z2<=fused->Z2_max && Z2<=table->Z2_max; Z2++) {
+            if (table->assigned_files[Z1][Z2] != fused)
+                continue;
+            sto=gsto_fuse_pair(table, fused, Z1, Z2);
+            if(sto) {
+                gsto_store_pair(table, Z1, Z2, sto);
+                free(sto);
+            }
+        }
+    }
+    return 1;
+}
+
+static double gsto_E_per_u_to_x(const gsto_file_t *file, double E_per_u) { /* Like gsto_v_to_x(), from keV/u. Files in keV/u need no conversion. */
+    switch (file->xunit) {
+        case GSTO_X_UNIT_KEV_U:
+            return E_per_u;
+        case GSTO_X_UNIT_M_S:
+        default:
+            return gsto_velocity(E_per_u*C_KEV, C_AMU);
+    }
+}
+
+static int gsto_lookup_pair(const gsto_table_t *table, int Z1, int Z2, gsto_error_t *error) { /* Index to pairs for a lookup, -1 and error set if there is no stopping */
+    int id;
+    if (Z1 <= 0 || Z1 > table->Z1_max) {
+        *error=GSTO_ERR_Z1_OUT_OF_RANGE;
+        return -1;
+    }
+    if (Z2 <= 0 || Z2 > table->Z2_max) {
+        *error=GSTO_ERR_Z2_OUT_OF_RANGE;
+        return -1;
+    }
+    /* Now Z1 and Z2 should be sane */
+    id = table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+    if(table->lazy && id < 0) {
+        gsto_load_pair((gsto_table_t *)table, Z1, Z2); /* Lazy tables are filled in by lookups */
+        id = table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+    }
+    /* No stopping loaded */
+    if(id < 0) {
+        *error=GSTO_ERR_NOT_ASSIGNED;
+    }
+    return id;
+}
+
+static double gsto_sto_v_error(const gsto_table_t *table, int Z1, int Z2, double v, gsto_error_t *error) { /* Lookup without side effects, problems are reported through error */
+    const gsto_file_t *file;
+    int id=gsto_lookup_pair(table, Z1, Z2, error);
+    if(id < 0)
+        return 0;
+    file = table->pairs[id].file;
+    return gsto_interpolate(file, gsto_pair_data(table, id), table->storage, gsto_v_to_x(file, v), error);
+}
+
+static double gsto_sto_E_per_u_error(const gsto_table_t *table, int Z1, int Z2, double E_per_u, gsto_error_t *error) { /* Like gsto_sto_v_error(), E_per_u in keV/u */
+    const gsto_file_t *file;
+    int id=gsto_lookup_pair(table, Z1, Z2, error);
+    if(id < 0)
+        return 0;
+    file = table->pairs[id].file;
+    return gsto_interpolate(file, gsto_pair_data(table, id), table->storage, gsto_E_per_u_to_x(file, E_per_u), error);
+}
+
+static void gsto_print_error(gsto_error_t error, int Z1, int Z2, double x, const char *x_unit) {
+    switch (error) {
+        case GSTO_ERR_Z1_OUT_OF_RANGE:
+            fprintf(stderr, "Z1=%i out of range!\n", Z1);
+            break;
+        case GSTO_ERR_Z2_OUT_OF_RANGE:
+            fprintf(stderr, "Z2=%i out of range!\n", Z2);
+            break;
+        case GSTO_ERR_NOT_ASSIGNED:
+            fprintf(stderr, "No stopping file assigned to Z1=%i Z2=%i\n", Z1, Z2);
+            break;
+        case GSTO_ERR_X_OUT_OF_RANGE:
+#ifdef DEBUG
+            fprintf(stderr, "%e %s out of range of the table for Z1=%i Z2=%i!\n", x, x_unit, Z1, Z2);
+#endif
+            break;
+        default:
+            break;
+    }
+}
+
+double gsto_sto_v(const gsto_table_t *table, int Z1, int Z2, double v) { /* Simplest way to access stopping data */
+    gsto_error_t error=GSTO_ERR_NONE;
+    double sto=gsto_sto_v_error(table, Z1, Z2, v, &error);
+    gsto_print_error(error, Z1, Z2, v, "m/s");
+    return sto;
+}
+
+double gsto_sto_E_per_u(const gsto_table_t *table, int Z1, int Z2, double E_per_u) { /* Stopping at energy per mass E_per_u (keV/u), no conversion through velocity for files in keV/u */
+    gsto_error_t error=GSTO_ERR_NONE;
+    double sto=gsto_sto_E_per_u_error(table, Z1, Z2, E_per_u, &error);
+    gsto_print_error(error, Z1, Z2, E_per_u, "keV/u");
     return sto;
 }
 
-double *gsto_sto_v_table(gsto_table_t *table, int Z1, int Z2, double v_min, double v_max, int points) {
+double gsto_sto_E(const gsto_table_t *table, int Z1, int Z2, double E, double mass) { /* Stopping of an ion with energy E (J) and mass (kg) */
+    return gsto_sto_E_per_u(table, Z1, Z2, E/mass*(C_AMU/C_KEV));
+}
+
+gsto_handle_t *gsto_handle_allocate(const gsto_table_t *table) { /* One handle per thread, the table is shared */
+    gsto_handle_t *handle = malloc(sizeof(gsto_handle_t));
+    if(!handle)
+        return NULL;
+    handle->table=table;
+    handle->error=GSTO_ERR_NONE;
+    handle->n_errors=0;
+    return handle;
+}
+
+int gsto_handle_deallocate(gsto_handle_t *handle) {
+    if(!handle)
+        return 0;
+    free(handle);
+    return 1;
+}
+
+double gsto_handle_sto_v(gsto_handle_t *handle, int Z1, int Z2, double v) { /* Like gsto_sto_v(), but silent and reentrant. Check handle->error. */
+    gsto_error_t error=GSTO_ERR_NONE;
+    double sto=gsto_sto_v_error(handle->table, Z1, Z2, v, &error);
+    handle->error=error;
+    if(error != GSTO_ERR_NONE)
+        handle->n_errors++;
+    return sto;
+}
+
+const char *gsto_error_string(gsto_error_t error) {
+    if(error < 0 || error >= GSTO_N_ERRORS)
+        return "unknown error";
+    return gsto_errors[error];
+}
+
+double *gsto_sto_v_table(const gsto_table_t *table, int Z1, int Z2, double v_min, double v_max, int points) {
     double *stoppings_out = malloc(sizeof(double)*points);
     double v_step=(v_max-v_min)/(points-1.0);
     double v;
@@ -553,3 +1154,187 @@ double *gsto_sto_v_table(gsto_table_t *table, int Z1, int Z2, double v_min, doub
     return stoppings_out;
 }
 
+
+gsto_mixture_t *gsto_mixture_allocate(int Z1_max) {
+    gsto_mixture_t *mixture = malloc(sizeof(gsto_mixture_t));
+    if(!mixture)
+        return NULL;
+    mixture->n_elements=0;
+    mixture->Z2=NULL; /* These will be allocated by gsto_mixture_set_fraction */
+    mixture->fractions=NULL;
+    mixture->Z1_max=Z1_max;
+    mixture->grids = (const gsto_file_t **)calloc(Z1_max+1, sizeof(gsto_file_t *));
+    mixture->sto = (double **)calloc(Z1_max+1, sizeof(double *));
+    return mixture;
+}
+
+int gsto_mixture_deallocate(gsto_mixture_t *mixture) {
+    if(!mixture) {
+        return 0;
+    }
+    gsto_mixture_invalidate(mixture);
+    free(mixture->grids);
+    free(mixture->sto);
+    free(mixture->Z2);
+    free(mixture->fractions);
+    free(mixture);
+    return 1;
+}
+
+int gsto_mixture_invalidate(gsto_mixture_t *mixture) { /* Throw away combined tables, they are rebuilt on next lookup */
+    int Z1;
+    for(Z1=0; Z1<=mixture->Z1_max; Z1++) {
+        free(mixture->sto[Z1]);
+        mixture->sto[Z1]=NULL;
+        mixture->grids[Z1]=NULL;
+    }
+    return 1;
+}
+
+int gsto_mixture_set_fraction(gsto_mixture_t *mixture, int Z2, double fraction) { /* Adds Z2 to the mixture if it is not there already. Fractions are atomic fractions, they don't have to sum up to one. */
+    int i;
+    for(i=0; i<mixture->n_elements; i++) {
+        if(mixture->Z2[i] == Z2) {
+            break;
+        }
+    }
+    if(i == mixture->n_elements) {
+        mixture->Z2 = realloc(mixture->Z2, sizeof(int)*(mixture->n_elements+1));
+        mixture->fractions = realloc(mixture->fractions, sizeof(double)*(mixture->n_elements+1));
+        mixture->Z2[i]=Z2;
+        mixture->fractions[i]=0.0;
+        mixture->n_elements++;
+    }
+    if(mixture->fractions[i] != fraction) { /* Only a real change of composition invalidates the tables */
+        mixture->fractions[i]=fraction;
+        gsto_mixture_invalidate(mixture);
+    }
+    return 1;
+}
+
+int gsto_mixture_build(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1) { /* Combine stopping of Z1 in mixture elements using Bragg's rule */
+    int i, j, Z2, id;
+    double sum=0.0, f;
+    double *sto, *slopes;
+    const void *data;
+    const gsto_file_t *grid=NULL, *file;
+    if (Z1 <= 0 || Z1 > table->Z1_max || Z1 > mixture->Z1_max) {
+        fprintf(stderr, "Z1=%i out of range!\n", Z1);
+        return 0;
+    }
+    for(i=0; i<mixture->n_elements; i++) {
+        Z2=mixture->Z2[i];
+        if(table->lazy && Z2 > 0 && Z2 <= table->Z2_max) {
+            gsto_load_pair((gsto_table_t *)table, Z1, Z2);
+        }
+        if (Z2 <= 0 || Z2 > table->Z2_max || table->pair_ids[Z1*(table->Z2_max+1)+Z2] < 0) {
+            fprintf(stderr, "No stopping file assigned to Z1=%i Z2=%i\n", Z1, Z2);
+            return 0;
+        }
+        if(!grid) {
+            grid=table->pairs[table->pair_ids[Z1*(table->Z2_max+1)+Z2]].file; /* The combined table uses the grid of the first element */
+        }
+        sum += mixture->fractions[i];
+    }
+    if(!grid) {
+        fprintf(stderr, "Mixture has no elements!\n");
+        return 0;
+    }
+    sto = calloc(gsto_has_slopes(grid)?2*grid->xpoints:grid->xpoints, sizeof(double)); /* Slopes follow, like in the arena */
+    for(i=0; i<mixture->n_elements && sum > 0.0; i++) {
+        Z2=mixture->Z2[i];
+        f=mixture->fractions[i]/sum;
+        id=table->pair_ids[Z1*(table->Z2_max+1)+Z2];
+        file=table->pairs[id].file;
+        if(file == grid) { /* Same grid, no interpolation needed */
+            data=gsto_pair_data(table, id);
+            for(j=0; j<grid->xpoints; j++) {
+                sto[j] += f*gsto_value(data, table->storage, j);
+            }
+        } else {
+            for(j=0; j<grid->xpoints; j++) {
+                sto[j] += f*gsto_sto_v(table, Z1, Z2, gsto_x_to_v(grid, gsto_file_x(grid, j)));
+            }
+        }
+    }
+#ifdef DEBUG
+    fprintf(stderr, "Built mixture stopping table for Z1=%i, %i elements, grid from file %s.\n", Z1, mixture->n_elements, grid->name);
+#endif
+    if(gsto_has_slopes(grid)) {
+        slopes=gsto_monotone_slopes(sto, grid->xpoints);
+        memcpy(sto+grid->xpoints, slopes, sizeof(double)*grid->xpoints);
+        free(slopes);
+    }
+    free(mixture->sto[Z1]);
+    mixture->sto[Z1]=sto;
+    mixture->grids[Z1]=grid;
+    return 1;
+}
+
+double gsto_mixture_sto_v(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double v) {
+    if (Z1 <= 0 || Z1 > mixture->Z1_max) {
+        fprintf(stderr, "Z1=%i out of range!\n", Z1);
+        return 0;
+    }
+    if(mixture->sto[Z1] == NULL) {
+        if(!gsto_mixture_build(table, mixture, Z1))
+            return 0;
+    }
+    return gsto_interpolate(mixture->grids[Z1], mixture->sto[Z1], GSTO_STORAGE_DOUBLE, gsto_v_to_x(mixture->grids[Z1], v), NULL);
+}
+
+static double gsto_grid_to_x(const gsto_file_t *file, const gsto_grid_t *grid, double x) { /* Native x of file at x of the grid */
+    switch (grid->unit) {
+        case GSTO_GRID_E:
+            return gsto_E_per_u_to_x(file, x/grid->mass*(C_AMU/C_KEV));
+        case GSTO_GRID_E_PER_U:
+            return gsto_E_per_u_to_x(file, x);
+        case GSTO_GRID_V:
+        default:
+            return gsto_v_to_x(file, x);
+    }
+}
+
+static void gsto_sweep(const gsto_file_t *file, const void *data, gsto_storage_t storage, const gsto_grid_t *grid, double *sto) { /* Interpolate data at every point of the grid, zero outside the file */
+    int i;
+    double step=(grid->points > 1)?(grid->x_max-grid->x_min)/(grid->points-1):0.0;
+    for(i=0; i<grid->points; i++) {
+        sto[i]=gsto_interpolate(file, data, storage, gsto_grid_to_x(file, grid, grid->x_min+step*i), NULL);
+    }
+}
+
+int gsto_resample(const gsto_table_t *table, int Z1, int Z2, const gsto_grid_t *grid, double *sto) { /* Stopping of Z1 in Z2 at grid->points points to sto */
+    gsto_error_t error=GSTO_ERR_NONE;
+    int id=gsto_lookup_pair(table, Z1, Z2, &error);
+    if(id < 0) {
+        gsto_print_error(error, Z1, Z2, 0.0, "");
+        return 0;
+    }
+    gsto_sweep(table->pairs[id].file, gsto_pair_data(table, id), table->storage, grid, sto);
+    return 1;
+}
+
+int gsto_mixture_resample(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, const gsto_grid_t *grid, double *sto) { /* Like gsto_resample() for a mixture */
+    if (Z1 <= 0 || Z1 > mixture->Z1_max) {
+        fprintf(stderr, "Z1=%i out of range!\n", Z1);
+        return 0;
+    }
+    if(mixture->sto[Z1] == NULL) {
+        if(!gsto_mixture_build(table, mixture, Z1))
+            return 0;
+    }
+    gsto_sweep(mixture->grids[Z1], mixture->sto[Z1], GSTO_STORAGE_DOUBLE, grid, sto);
+    return 1;
+}
+
+double gsto_mixture_sto_E_per_u(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double E_per_u) { /* Like gsto_sto_E_per_u() */
+    if (Z1 <= 0 || Z1 > mixture->Z1_max) {
+        fprintf(stderr, "Z1=%i out of range!\n", Z1);
+        return 0;
+    }
+    if(mixture->sto[Z1] == NULL) {
+        if(!gsto_mixture_build(table, mixture, Z1))
+            return 0;
+    }
+    return gsto_interpolate(mixture->grids[Z1], mixture->sto[Z1], GSTO_STORAGE_DOUBLE, gsto_E_per_u_to_x(mixture->grids[Z1], E_per_u), NULL);
+}
@@ -9,7 +9,7 @@ typedef enum {
     STO_TOT=3
 } stopping_type_t;
 
-#define GSTO_N_DATA_FORMATS 2
+#define GSTO_N_DATA_FORMATS 3
 typedef enum {
     GSTO_DF_NONE=0,
     GSTO_DF_ASCII=1,
@@ -36,7 +36,27 @@ typedef enum {
     GSTO_STO_UNIT_EV15CM2=1, /* eV/(1e15 at/cm^2)*/
 } stopping_stounit_t;
 
-#define GSTO_N_HEADER_TYPES 13
+#define GSTO_N_INTERPOLATIONS 3
+typedef enum {
+    GSTO_INTERP_NONE=0, /* Use the default of the table */
+    GSTO_INTERP_LINEAR=1,
+    GSTO_INTERP_CUBIC=2 /* Monotone cubic Hermite, slopes precomputed at load time */
+} stopping_interpolation_t;
+
+#define GSTO_N_STORAGES 2
+typedef enum {
+    GSTO_STORAGE_DOUBLE=0,
+    GSTO_STORAGE_FLOAT=1 /* Half the memory, about seven significant digits */
+} gsto_storage_t;
+
+#define GSTO_N_GRID_UNITS 3
+typedef enum {
+    GSTO_GRID_V=0, /* m/s */
+    GSTO_GRID_E=1, /* J, needs the mass of the ion */
+    GSTO_GRID_E_PER_U=2 /* keV/u */
+} gsto_grid_unit_t;
+
+#define GSTO_N_HEADER_TYPES 14
 typedef enum {
     GSTO_HEADER_NONE=0,
     GSTO_HEADER_SOURCE=1,
@@ -50,11 +70,20 @@ typedef enum {
     GSTO_HEADER_XMIN=9,
     GSTO_HEADER_XMAX=10,
     GSTO_HEADER_XPOINTS=11,
-    GSTO_HEADER_XSCALE=12
+    GSTO_HEADER_XSCALE=12,
+    GSTO_HEADER_INTERPOLATION=13
 } header_properties_t;
 
+#define GSTO_N_ERRORS 5
+typedef enum {
+    GSTO_ERR_NONE=0,
+    GSTO_ERR_Z1_OUT_OF_RANGE=1,
+    GSTO_ERR_Z2_OUT_OF_RANGE=2,
+    GSTO_ERR_NOT_ASSIGNED=3,
+    GSTO_ERR_X_OUT_OF_RANGE=4
+} gsto_error_t;
+
 typedef struct {
-    int lineno; /* Keep track of how many lines read */
     /* file contains stopping for Z1 = Z1_min .. Z1_max inclusive in Z2 = Z2_min .. Z2_max inclusive i.e. (Z1_max-Z1_min+1)*(Z2_max-Z2_min+1) combinations */
     int Z1_min; 
     int Z2_min;
@@ -68,33 +97,137 @@ typedef struct {
     stopping_stounit_t stounit; /* Stopping unit */
     stopping_type_t type; /* does this file contain nuclear, electronic or total stopping? */
     stopping_data_format_t data_format; /* What does the data look like (after headers) */
-    FILE *fp;
+    stopping_interpolation_t interpolation; /* How to interpolate between the points */
     char *name; /* Descriptive name of the file, from the settings file */
     char *filename; /* Filename (relative or full path, whatever fopen can chew) */
+    long data_offset; /* Position of the data after the headers, for loading single combinations */
+    long *block_offsets; /* Positions of each Z1, Z2 block of an ascii file, indexed on first lazy load */
+    int fused; /* Stopping is merged from the files listed after this one on a grid of xpoints, nothing is read from filename */
+    double fuse_xmin; /* keV/u, this file is preferred between fuse_xmin and fuse_xmax when merged to a fused file. Zero for no limit. */
+    double fuse_xmax;
 } gsto_file_t;
 
-typedef struct {
+typedef struct { /* A loaded Z1, Z2 combination */
+    const gsto_file_t *file; /* The grid of the stopping */
+    size_t offset; /* Position of the stopping in the arena, in points. For cubic interpolation file->xpoints slopes follow. */
+} gsto_pair_t;
+
+typedef struct { /* Loaded stopping. Not modified by lookups after gsto_load(), so it can be shared between threads using gsto_handle_t. */
     int Z1_max;
     int Z2_max;
     int n_files;
     gsto_file_t *files; /* table of gsto_file_t */
     gsto_file_t ***assigned_files; /* files[Z1][Z2] pointers */
-    double ***ele; /* ele[Z1][Z2] tables */
+    int *pair_ids; /* pair_ids[Z1*(Z2_max+1)+Z2], index to pairs or -1 if the combination is not loaded */
+    int n_pairs;
+    int pairs_allocated;
+    gsto_pair_t *pairs;
+    void *arena; /* Stopping of all loaded combinations in one block, double or float depending on storage */
+    size_t arena_points; /* Points in use */
+    size_t arena_allocated; /* Points allocated */
+    gsto_storage_t storage;
     double ***nuc; /* nuc[Z1][Z2] tables */
+    stopping_interpolation_t interpolation; /* Default interpolation for files that don't specify one */
+    int lazy; /* Assign and load combinations on first lookup. Lookups then modify the table, so it must not be shared between threads. */
+    void *image; /* Shared memory segment or cache file the arena lives in when attached, NULL otherwise */
+    size_t image_size;
+    int image_mapped; /* Image is mapped (and not allocated) memory */
 } gsto_table_t;
 
+typedef struct { /* Per-thread lookup state for a shared table */
+    const gsto_table_t *table;
+    gsto_error_t error; /* Result of the latest lookup */
+    int n_errors; /* Number of failed lookups */
+} gsto_handle_t;
+
+typedef struct { /* Owned by one thread, combined tables are built on demand */
+    int n_elements;
+    int *Z2; /* Z2[i], i=0..n_elements-1 */
+    double *fractions; /* Atomic fractions of elements, normalized when the tables are built */
+    int Z1_max;
+    const gsto_file_t **grids; /* grids[Z1], the file whose x-grid is used for sto[Z1] */
+    double **sto; /* sto[Z1], stopping of the mixture (Bragg's rule) or NULL if not built yet. Slopes follow for cubic interpolation. */
+} gsto_mixture_t;
+
+typedef struct { /* Uniform grid chosen by the caller, points from x_min to x_max inclusive */
+    gsto_grid_unit_t unit;
+    double mass; /* kg, for GSTO_GRID_E */
+    double x_min;
+    double x_max;
+    int points;
+} gsto_grid_t;
+
+typedef struct {
+    char *key; /* Describes the combination or mixture, the grid and the files the stopping came from */
+    int points;
+    double *sto;
+} gsto_resample_entry_t;
+
+typedef struct {
+    char *directory; /* Resampled stopping is also stored here and reused by later runs, NULL to keep it in memory only */
+    int n_entries;
+    int next; /* Entry replaced next when the cache is full */
+    gsto_resample_entry_t *entries;
+} gsto_resample_cache_t;
+
+typedef struct {
+    int points;
+    double v_max; /* m/s, rho is tabulated for v = 0 ... v_max */
+    double *rho; /* rho[i], integral of v/S(v) dv from 0 to v=i*v_max/(points-1). Range of an ion of mass m is m*rho/e. */
+    double *drho; /* drho[i], v/S(v) at the same points, i.e. derivative of rho */
+    double *v; /* v[j], inverse of rho tabulated uniformly in sqrt(rho) up to sqrt(rho[points-1]) */
+} gsto_range_t;
+
 int gsto_add_file(gsto_table_t *table, char *name, char *filename, int Z1_min, int Z1_max, int Z2_min, int Z2_max, char *type);
+int gsto_add_fused(gsto_table_t *table, char *name, int Z1_min, int Z1_max, int Z2_min, int Z2_max, int xpoints, char *type);
 gsto_table_t *gsto_allocate(int Z1_max, int Z2_max);
 int gsto_deallocate(gsto_table_t *table);
 int gsto_assign(gsto_table_t *table, int Z1, int Z2, gsto_file_t *file);
-int gsto_load_binary_file(gsto_table_t *table, gsto_file_t *file);
-int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file);
+int gsto_load_binary_file(gsto_table_t *table, gsto_file_t *file, FILE *fp);
+int gsto_load_ascii_file(gsto_table_t *table, gsto_file_t *file, FILE *fp);
 int gsto_load(gsto_table_t *table);
+int gsto_set_lazy(gsto_table_t *table, int lazy);
+int gsto_set_storage(gsto_table_t *table, gsto_storage_t storage);
+int gsto_store_pair(gsto_table_t *table, int Z1, int Z2, const double *sto);
+int gsto_load_pair(gsto_table_t *table, int Z1, int Z2);
+int gsto_set_interpolation(gsto_table_t *table, stopping_interpolation_t interpolation);
+double *gsto_monotone_slopes(const double *data, int points);
 int gsto_print_files(gsto_table_t *table);
 int gsto_print_assignments(gsto_table_t *table);
 gsto_table_t *gsto_init(int Z_max, char *stoppings_file_name);
-double gsto_sto_v(gsto_table_t *table, int Z1, int Z2, double v);
-double *gsto_sto_v_table(gsto_table_t *table, int Z1, int Z2, double v_min, double v_max, int points);
-double gsto_sto_raw(gsto_table_t *table, int Z1, int Z2, int point_number);
+double gsto_sto_v(const gsto_table_t *table, int Z1, int Z2, double v);
+double gsto_sto_E_per_u(const gsto_table_t *table, int Z1, int Z2, double E_per_u);
+double gsto_sto_E(const gsto_table_t *table, int Z1, int Z2, double E, double mass);
+double *gsto_sto_v_table(const gsto_table_t *table, int Z1, int Z2, double v_min, double v_max, int points);
+double gsto_sto_raw(const gsto_table_t *table, int Z1, int Z2, int point_number);
+gsto_handle_t *gsto_handle_allocate(const gsto_table_t *table);
+int gsto_handle_deallocate(gsto_handle_t *handle);
+double gsto_handle_sto_v(gsto_handle_t *handle, int Z1, int Z2, double v);
+const char *gsto_error_string(gsto_error_t error);
 int gsto_auto_assign_range(gsto_table_t *table, int Z1_min, int Z1_max, int Z2_min, int Z2_max);
-int gsto_auto_assign(gsto_table_t *table, int Z1, int Z2);
\ No newline at end of file
+int gsto_auto_assign(gsto_table_t *table, int Z1, int Z2);
+gsto_mixture_t *gsto_mixture_allocate(int Z1_max);
+int gsto_mixture_deallocate(gsto_mixture_t *mixture);
+int gsto_mixture_invalidate(gsto_mixture_t *mixture);
+int gsto_mixture_set_fraction(gsto_mixture_t *mixture, int Z2, double fraction);
+int gsto_mixture_build(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1);
+double gsto_mixture_sto_v(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double v);
+double gsto_mixture_sto_E_per_u(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double E_per_u);
+int gsto_shm_publish(const gsto_table_t *table, const char *shm_name);
+gsto_table_t *gsto_shm_attach(const char *shm_name);
+int gsto_image_detach(gsto_table_t *table);
+int gsto_shm_unlink(const char *shm_name);
+gsto_table_t *gsto_init_shm(int Z_max, char *stoppings_file_name, const char *shm_name);
+int gsto_cache_write(const gsto_table_t *table, const char *filename);
+gsto_table_t *gsto_cache_load(const char *filename);
+int gsto_resample(const gsto_table_t *table, int Z1, int Z2, const gsto_grid_t *grid, double *sto);
+int gsto_mixture_resample(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, const gsto_grid_t *grid, double *sto);
+gsto_resample_cache_t *gsto_resample_cache_allocate(const char *directory);
+int gsto_resample_cache_deallocate(gsto_resample_cache_t *cache);
+const double *gsto_resample_cached(gsto_resample_cache_t *cache, const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, int Z2, const gsto_grid_t *grid);
+gsto_range_t *gsto_range_build(const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double v_max, int points);
+gsto_range_t *gsto_range_build_cached(gsto_resample_cache_t *cache, const gsto_table_t *table, gsto_mixture_t *mixture, int Z1, double v_max, int points);
+int gsto_range_deallocate(gsto_range_t *range);
+double gsto_range_R(const gsto_range_t *range, double mass, double E);
+double gsto_range_E(const gsto_range_t *range, double mass, double R);
+double gsto_range_E_after(const gsto_range_t *range, double mass, double E, double x);
\ No newline at end of file
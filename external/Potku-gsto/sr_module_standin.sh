@@ -0,0 +1,22 @@
+#!/bin/sh
+# Stand-in for SRModule.exe to try srim_gen_stop without SRIM or wine, e.g.
+#     SR_MODULE="sh /path/to/sr_module_standin.sh" srim_gen_stop -j 4
+# Reads SR.IN from the current directory and writes the output file named
+# there with made up (smooth, but not physical) stopping at the same energies.
+# SR_MODULE_DELAY seconds are spent per run to mimic a real SRModule.
+sleep ${SR_MODULE_DELAY:-0}
+tr -d '\r' < SR.IN | awk '
+    NR == 3 { gsub(/"/, ""); output=$0 }
+    NR == 5 { Z1=$1; M1=$2 }
+    NR == 11 { Z2=$1 }
+    NR >= 16 && NF > 0 { E[n++]=$1 }
+    END {
+        print "SR Module stand-in" > output
+        print "Ion Z1=" Z1 " in Z2=" Z2 > output
+        print "Energy(keV) S_elec S_nuc" > output
+        print "" > output
+        for(i=0; i<n; i++) {
+            x=E[i]/M1
+            printf "%e %e %e\n", E[i], Z1*sqrt(Z2)*sqrt(x)/(1+x/(100*Z1)), Z1*Z2/(1+x) > output
+        }
+    }'
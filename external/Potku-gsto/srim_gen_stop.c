@@ -10,11 +10,18 @@
 #include <inttypes.h>
 #include <math.h>
 #include <unistd.h>
+#include <libgsto.h>
 #include <gsto_masses.h>
 #include <errno.h>
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
 
 #ifdef WIN32
 #include "win_compat.h"
+#else
+#include <sys/types.h>
+#include <sys/wait.h>
 #endif
 
 
@@ -29,6 +36,8 @@
 #endif
 #define SR_FILE_PATH "SR.IN"
 #define SR_OUTPUT_FILE "stopping.dat"
+#define SR_MODULE_ENV "SR_MODULE" /* Command run instead of SR_MODULE_PATH if set, e.g. sr_module_standin.sh */
+#define WORKER_PATH_LENGTH 2000
 
 #define XSTR(x) STR(x)
 #define STR(x) #x
@@ -36,6 +45,22 @@
 #define XSTEPS 101
 #define Z_MAX 92
 
+typedef struct {
+    char *output; /* Stopping file to write */
+    char *srim_path; /* SR Module directory */
+    char *cache_dir; /* Results of each combination are kept here if not NULL */
+    double xmin; /* keV/amu */
+    double xmax;
+    int xsteps; /* steps numbered 0, 1, 2, ...., vsteps-1 */
+    int z1_min;
+    int z1_max;
+    int z2_min;
+    int z2_max;
+    int workers; /* Number of SRModule instances run at the same time */
+    int binary; /* Output in GSTO_DF_DOUBLE format instead of ASCII */
+    char *image; /* Image of the output loaded by libgsto is written here if not NULL, see gsto_cache_write() */
+} srim_settings_t;
+
 int generate_sr_in(char *out_filename, isotope_t *ion, isotope_t *target, int xsteps, double xmin, double xmax) {
     FILE *sr_file = fopen(out_filename, "w");
     int i;
@@ -67,6 +92,11 @@ int generate_sr_in(char *out_filename, isotope_t *ion, isotope_t *target, int xs
     return 1;
 }
 
+char *sr_module_command() {
+    char *command=getenv(SR_MODULE_ENV);
+    return command?command:SR_MODULE_PATH;
+}
+
 int run_srim(char *sr_module_path) {
     int result;
     result=system(sr_module_path);
@@ -75,8 +105,8 @@ int run_srim(char *sr_module_path) {
     return 1;
 }
 
-int parse_output(char *filename, FILE *stopping_output_file, isotope_t *ion, int xsteps) {
-    int lineno=0, i=1;
+int parse_output(char *filename, FILE *stopping_output_file, isotope_t *ion, int xsteps) { /* Returns the number of stopping values written, a complete result has xsteps */
+    int lineno=0, i=0;
     FILE *in_file=fopen(filename, "r");
     char *columns[3];
     char **col;
@@ -96,6 +126,8 @@ int parse_output(char *filename, FILE *stopping_output_file, isotope_t *ion, int
             if (**col != '\0')
                 if (++col >= &columns[3])
                     break;
+        if(col < &columns[3]) /* Not a line of energy and stopping, e.g. empty */
+            continue;
         energy=strtod(columns[0], NULL);
         S_elec=strtod(columns[1], NULL);
         S_nuc=strtod(columns[2], NULL);
@@ -108,8 +140,219 @@ int parse_output(char *filename, FILE *stopping_output_file, isotope_t *ion, int
     fflush(stopping_output_file);
     free(line);
     fclose(in_file);
-    return lineno;
+    return i;
+}
+
+#ifndef WIN32
+int run_pair_in_worker(char *worker_dir, char *result_file, isotope_t *ion, isotope_t *target, int xsteps, double xmin, double xmax) { /* In the child process. Result goes to a temporary file which is renamed when complete. */
+    char tmp_file[WORKER_PATH_LENGTH];
+    FILE *out;
+    int success;
+    if(chdir(worker_dir) != 0)
+        return 0;
+    if(!generate_sr_in(SR_FILE_PATH, ion, target, xsteps, xmin, xmax))
+        return 0;
+    remove(SR_OUTPUT_FILE);
+    if(!run_srim(sr_module_command()))
+        return 0;
+    snprintf(tmp_file, WORKER_PATH_LENGTH, "%s.tmp", result_file);
+    out=fopen(tmp_file, "w");
+    if(!out)
+        return 0;
+    success=(parse_output(SR_OUTPUT_FILE, out, ion, xsteps) == xsteps); /* Only complete results are kept, anything else would be skipped by later runs */
+    fclose(out);
+    if(!success || rename(tmp_file, result_file) != 0) {
+        remove(tmp_file);
+        return 0;
+    }
+    return 1;
+}
+
+int write_pair(FILE *stopping_output_file, srim_settings_t *settings, int Z1, int Z2, char *result_file) { /* Stopping of one combination from result_file, zeros if it is NULL. Blocks always have xsteps values, a missing result is zeros. */
+    int i;
+    char *line;
+    double *sto;
+    FILE *in_file=NULL;
+    if(!settings->binary)
+        fprintf(stopping_output_file, "#STOPPING IN Z1=%i Z2=%i\n", Z1, Z2);
+    if(result_file) {
+        in_file=fopen(result_file, "r");
+        if(!in_file)
+            fprintf(stderr, "No result for Z1=%i Z2=%i in %s, writing zeros.\n", Z1, Z2, result_file);
+    }
+    line=malloc(sizeof(char)*SRIM_OUTPUT_LINE_LENGTH);
+    sto=calloc(settings->xsteps, sizeof(double));
+    for(i=0; in_file && i < settings->xsteps && fgets(line, SRIM_OUTPUT_LINE_LENGTH, in_file) != NULL; i++) {
+        if(settings->binary) /* Same values as libgsto reading the ASCII output */
+            sto[i]=strtod(line, NULL);
+        else
+            fputs(line, stopping_output_file);
+    }
+    if(settings->binary) {
+        fwrite(sto, sizeof(double), settings->xsteps, stopping_output_file);
+    } else {
+        for(; i<settings->xsteps; i++) {
+            fprintf(stopping_output_file, "%e\n", 0.0); /* no isotopes found for either Z1 or Z2 or no result, fill with zeros */
+        }
+    }
+    if(in_file)
+        fclose(in_file);
+    free(line);
+    free(sto);
+    return (in_file != NULL || !result_file);
+}
+
+void pair_filename(char *filename, size_t size, char *dir, isotope_t *ion, isotope_t *target, srim_settings_t *settings) { /* Result of one combination, different energies give a different file */
+    snprintf(filename, size, "%s/%s_in_%s_%.10g-%.10g_%i", dir, ion->name, target->name, settings->xmin, settings->xmax, settings->xsteps);
+}
+
+int run_pairs(isotopes_t *isotopes, FILE *stopping_output_file, srim_settings_t *settings) { /* Pairs are run by a pool of worker processes, each in a scratch copy of the SR Module directory (the current directory) or with one worker in that directory. Output is written in the same order as serially. Finished combinations are kept in the cache directory and not run again. */
+    char root[WORKER_PATH_LENGTH], cwd[WORKER_PATH_LENGTH], dir[2*WORKER_PATH_LENGTH], filename[3*WORKER_PATH_LENGTH], command[3*WORKER_PATH_LENGTH];
+    char *tmpdir=getenv("TMPDIR");
+    char *results;
+    int k, i, status, n_done=0, n_failed=0, n_running=0, n_todo=0;
+    int n_z1=settings->z1_max-settings->z1_min+1, n_z2=settings->z2_max-settings->z2_min+1, n_pairs=n_z1*n_z2, next=0;
+    int workers=settings->workers;
+    int *worker_pair=malloc(sizeof(int)*workers); /* Index of the pair a worker is running, -1 if idle */
+    pid_t *worker_pid=malloc(sizeof(pid_t)*workers);
+    char *todo=calloc(n_pairs, sizeof(char)); /* Combinations that are run */
+    pid_t pid;
+    isotope_t *ion, *target;
+    snprintf(root, WORKER_PATH_LENGTH, "%s/srim_gen_stop.XXXXXX", tmpdir?tmpdir:"/tmp");
+    if(!mkdtemp(root) || !getcwd(cwd, WORKER_PATH_LENGTH)) {
+        fprintf(stderr, "Could not create a scratch directory %s.\n", root);
+        return 0;
+    }
+    results=settings->cache_dir?settings->cache_dir:root;
+    for(i=0; i<n_pairs; i++) {
+        ion=find_most_abundant_isotope(isotopes, settings->z1_min+i/n_z2);
+        target=find_most_abundant_isotope(isotopes, settings->z2_min+i%n_z2);
+        if(!ion || !target) /* Filled with zeros when writing */
+            continue;
+        pair_filename(filename, sizeof(filename), results, ion, target, settings);
+        if(access(filename, R_OK) == 0)
+            continue;
+        todo[i]=1;
+        n_todo++;
+    }
+    fprintf(stderr, "%i of %i combinations to run, others are %s.\n", n_todo, n_pairs, settings->cache_dir?"cached or have no isotopes":"without isotopes");
+    if(workers > n_todo)
+        workers=n_todo;
+    for(k=0; k<workers; k++) {
+        worker_pair[k]=-1;
+        if(workers == 1)
+            break;
+        snprintf(command, sizeof(command), "cp -R . \"%s/worker%i\"", root, k);
+        if(system(command) != 0) {
+            fprintf(stderr, "Could not copy SR Module directory to %s/worker%i.\n", root, k);
+            return 0;
+        }
+    }
+    if(workers > 1)
+        fprintf(stderr, "Running SRModule in %i workers, scratch directories are in %s.\n", workers, root);
+    while(next < n_pairs || n_running) {
+        for(k=0; k<workers && next < n_pairs; k++) {
+            if(worker_pair[k] >= 0)
+                continue;
+            while(next < n_pairs && !todo[next])
+                next++;
+            if(next == n_pairs)
+                break;
+            ion=find_most_abundant_isotope(isotopes, settings->z1_min+next/n_z2);
+            target=find_most_abundant_isotope(isotopes, settings->z2_min+next%n_z2);
+            fprintf(stderr, "Running SRModule for %s in %s.\n", ion->name, target->name);
+            fflush(stderr);
+            pid=fork();
+            if(pid < 0) {
+                fprintf(stderr, "Could not start a worker, error number %i.\n", errno);
+                break;
+            }
+            if(pid == 0) {
+                if(workers == 1)
+                    snprintf(dir, sizeof(dir), "%s", cwd);
+                else
+                    snprintf(dir, sizeof(dir), "%s/worker%i", root, k);
+                pair_filename(filename, sizeof(filename), results, ion, target, settings);
+                _exit(run_pair_in_worker(dir, filename, ion, target, settings->xsteps, settings->xmin, settings->xmax)?0:1);
+            }
+            worker_pid[k]=pid;
+            worker_pair[k]=next++;
+            n_running++;
+        }
+        if(!n_running)
+            break;
+        pid=wait(&status);
+        if(pid < 0)
+            break;
+        for(k=0; k<workers; k++) {
+            if(worker_pair[k] >= 0 && worker_pid[k] == pid)
+                break;
+        }
+        if(k == workers)
+            continue;
+        n_done++;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            n_failed++;
+        fprintf(stderr, "Z1=%i. Z2=%i. %s %i/%i.\n", settings->z1_min+worker_pair[k]/n_z2, settings->z2_min+worker_pair[k]%n_z2, (WIFEXITED(status) && WEXITSTATUS(status) == 0)?"OK.":"Not OK", n_done, n_todo);
+        worker_pair[k]=-1;
+        n_running--;
+    }
+    for(i=0; i<n_pairs; i++) {
+        ion=find_most_abundant_isotope(isotopes, settings->z1_min+i/n_z2);
+        target=find_most_abundant_isotope(isotopes, settings->z2_min+i%n_z2);
+        if(ion && target)
+            pair_filename(filename, sizeof(filename), results, ion, target, settings);
+        write_pair(stopping_output_file, settings, settings->z1_min+i/n_z2, settings->z2_min+i%n_z2, (ion && target)?filename:NULL);
+    }
+    fflush(stopping_output_file);
+    snprintf(command, sizeof(command), "rm -rf \"%s\"", root);
+    system(command);
+    free(worker_pair);
+    free(worker_pid);
+    free(todo);
+    if(n_failed || n_done < n_todo) {
+        fprintf(stderr, "%i combinations could not be generated.%s\n", n_todo-n_done+n_failed, settings->cache_dir?" Run again with the same cache to retry only those.":"");
+        return 0;
+    }
+    return 1;
 }
+#else
+int run_pairs_serial(isotopes_t *isotopes, FILE *stopping_output_file, srim_settings_t *settings) { /* Without worker processes, in the SR Module directory */
+    int Z1, Z2, i=0, j;
+    int n_combinations=(settings->z1_max-settings->z1_min+1)*(settings->z2_max-settings->z2_min+1);
+    isotope_t *ion, *target;
+    for(Z1=settings->z1_min; Z1<=settings->z1_max; Z1++) {
+        ion = find_most_abundant_isotope(isotopes, Z1);
+        for(Z2=settings->z2_min; Z2<=settings->z2_max; Z2++) {
+            i++;
+            target = find_most_abundant_isotope(isotopes, Z2);
+            fprintf(stopping_output_file, "#STOPPING IN Z1=%i Z2=%i\n", Z1, Z2);
+            if(ion && target) {
+                fprintf(stderr, "SR.IN will be generated for %s in %s.\n", ion->name, target->name);
+                generate_sr_in(SR_FILE_PATH, ion, target, settings->xsteps, settings->xmin, settings->xmax);
+                fprintf(stderr, "Running SRModule, please wait.\n");
+                if(run_srim(sr_module_command())) {
+                    if(parse_output(SR_OUTPUT_FILE, stopping_output_file, ion, settings->xsteps) == settings->xsteps) {
+                        fprintf(stderr, "Z1=%i. Z2=%i. OK. %i/%i.\n", Z1, Z2, i, n_combinations);
+                    } else {
+                        fprintf(stderr, "Z1=%i. Z2=%i. Not OK %i/%i.\n", Z1, Z2, i, n_combinations);
+                    }
+                } else {
+                    fprintf(stderr, "Error in running SRModule. You should really consider running this program in the working directory of SR Module.\n");
+                    exit(0);
+                }
+            } else {
+                for(j=0; j<settings->xsteps; j++) {
+                    fprintf(stopping_output_file, "%e\n", 0.0); /* no isotopes found for either Z1 or Z2, fill with zeros */
+                }
+                fflush(stdout);
+            }
+        }
+        sleep(1);
+    }
+    return 1;
+}
+#endif
 
 void remove_newline(char *s) {
     int i;
@@ -119,101 +362,208 @@ void remove_newline(char *s) {
     }
 }
 
+int set_setting(srim_settings_t *settings, char *key, char *value) { /* Keys are those of the stopping file header where possible */
+    if(strcmp(key, "output") == 0) {
+        settings->output=strdup(value);
+    } else if(strcmp(key, "srim-path") == 0) {
+        settings->srim_path=strdup(value);
+    } else if(strcmp(key, "cache") == 0) {
+        settings->cache_dir=strdup(value);
+    } else if(strcmp(key, "x-min") == 0) {
+        settings->xmin=strtod(value, NULL);
+    } else if(strcmp(key, "x-max") == 0) {
+        settings->xmax=strtod(value, NULL);
+    } else if(strcmp(key, "x-points") == 0) {
+        settings->xsteps=strtol(value, NULL, 10);
+    } else if(strcmp(key, "z1-min") == 0) {
+        settings->z1_min=strtol(value, NULL, 10);
+    } else if(strcmp(key, "z1-max") == 0) {
+        settings->z1_max=strtol(value, NULL, 10);
+    } else if(strcmp(key, "z2-min") == 0) {
+        settings->z2_min=strtol(value, NULL, 10);
+    } else if(strcmp(key, "z2-max") == 0) {
+        settings->z2_max=strtol(value, NULL, 10);
+    } else if(strcmp(key, "workers") == 0) {
+        settings->workers=strtol(value, NULL, 10);
+    } else if(strcmp(key, "format") == 0) {
+        if(strcmp(value, "binary") == 0) {
+            settings->binary=1;
+        } else if(strcmp(value, "ascii") == 0) {
+            settings->binary=0;
+        } else {
+            fprintf(stderr, "Unknown format \"%s\", use ascii or binary.\n", value);
+            return 0;
+        }
+    } else if(strcmp(key, "image") == 0) {
+        settings->image=strdup(value);
+    } else {
+        fprintf(stderr, "Unknown setting \"%s\".\n", key);
+        return 0;
+    }
+    return 1;
+}
+
+int set_setting_line(srim_settings_t *settings, char *line) { /* "key=value" */
+    char *value;
+    remove_newline(line);
+    if(line[0] == '#' || line[0] == '\0')
+        return 1;
+    value=strchr(line, '=');
+    if(!value) {
+        fprintf(stderr, "Expected key=value, got \"%s\".\n", line);
+        return 0;
+    }
+    *value++='\0';
+    return set_setting(settings, line, value);
+}
 
-int main (int argc, char **argv) {
-    isotopes_t *isotopes=load_isotope_table(XSTR(MASSES_DATA));
-    if(!isotopes) {
-        fprintf(stderr, "Could not load table of isotopes from %s!\n", XSTR(MASSES_DATA));
-        return 0;
-    }
-    int Z1, Z2, i, j;
-    double xmin=10.0; /* keV/amu */
-    double xmax=10000.0; 
-    int xsteps=XSTEPS; /* steps numbered 0, 1, 2, ...., vsteps-1 */
-    int z1_min=1;
-    int z2_min=1;
-    int z1_max=Z_MAX; 
-    int z2_max=Z_MAX;
-    int n_combinations;
-    isotope_t *ion, *target;
-    FILE *stopping_output_file;
-    i=0;
+int read_settings(srim_settings_t *settings, char *filename) {
+    char *line=malloc(sizeof(char)*2000);
+    int success=1;
+    FILE *in_file=fopen(filename, "r");
+    if(!in_file) {
+        fprintf(stderr, "Could not open settings file %s.\n", filename);
+        free(line);
+        return 0;
+    }
+    while(success && fgets(line, 2000, in_file) != NULL) {
+        success=set_setting_line(settings, line);
+    }
+    fclose(in_file);
+    free(line);
+    return success;
+}
+
+int write_image(srim_settings_t *settings) { /* Output loaded like any stopping file and written as an image for gsto_cache_load() */
+    int success=0;
+#ifdef WIN32
+    char *filename=strdup(settings->output);
+#else
+    char *filename=realpath(settings->output, NULL); /* The image refers to the file, it can be used from anywhere */
+#endif
+    gsto_table_t *table=filename?gsto_allocate(settings->z1_max, settings->z2_max):NULL;
+    if(table && gsto_add_file(table, "srim", filename, settings->z1_min, settings->z1_max, settings->z2_min, settings->z2_max, "tot")) {
+        gsto_auto_assign_range(table, settings->z1_min, settings->z1_max, settings->z2_min, settings->z2_max);
+        success=gsto_load(table) && gsto_cache_write(table, settings->image);
+    }
+    if(!success)
+        fprintf(stderr, "Could not write image %s.\n", settings->image);
+    gsto_deallocate(table);
+    free(filename);
+    return success;
+}
+
+void ask_settings(srim_settings_t *settings) {
     char *input=malloc(sizeof(char)*1000);
     fprintf(stderr, "Please enter output filename, e.g. \"srim.tot\": ");
     fgets(input, 1000, stdin);
     remove_newline(input); 
-    stopping_output_file = fopen(input, "w");
-    if(!stopping_output_file) {
-        fprintf(stderr, "Could not open file \"%s\" for output", input);
-        return 0;
-    }
+    settings->output=strdup(input);
 #ifdef WIN32 
     fprintf(stderr, "Please enter SRIM path, e.g. \"C:\\SRIM\\SR Module\\\": ");
 #else
     fprintf(stderr, "Please enter SRIM path, e.g. \"/home/user/.wine/drive_c/SRIM/SR Module/\"\n> ");
 #endif
-    char *srim_path=malloc(sizeof(char)*2000);
-    fgets(srim_path, 2000, stdin);
-    remove_newline(srim_path);
-    fprintf(stderr, "Attempting to chdir to \"%s\"\n", srim_path);
-    if(chdir(srim_path) != 0) {
-        fprintf(stderr, "Could not chdir to given path. Error number %i.\n", errno);
-        return 0;
-    }
+    settings->srim_path=malloc(sizeof(char)*2000);
+    fgets(settings->srim_path, 2000, stdin);
+    remove_newline(settings->srim_path);
     fprintf(stderr, "Input minimum energy in keV/u (e.g. 10): ");
     fgets(input, 1000, stdin);
-    xmin=strtod(input, NULL);
+    settings->xmin=strtod(input, NULL);
     fprintf(stderr, "Input maximum energy in keV/u (e.g. 10000): ");
     fgets(input, 1000, stdin);
-    xmax=strtod(input, NULL);
+    settings->xmax=strtod(input, NULL);
     fprintf(stderr, "Input number of stopping steps to calculate between xmin and xmax in log scale (e.g. 101): ");
     fgets(input, 1000, stdin);
-    xsteps=strtol(input, NULL, 10);
+    settings->xsteps=strtol(input, NULL, 10);
     fprintf(stderr, "Input Z1 minimum (e.g. 1): ");
     fgets(input, 1000, stdin);
-    z1_min=strtol(input, NULL, 10);
+    settings->z1_min=strtol(input, NULL, 10);
     fprintf(stderr, "Input Z1 maximum (e.g. 92): ");
     fgets(input, 1000, stdin);
-    z1_max=strtol(input, NULL, 10);
+    settings->z1_max=strtol(input, NULL, 10);
     fprintf(stderr, "Input Z2 minimum (e.g. 1): ");
     fgets(input, 1000, stdin);
-    z2_min=strtol(input, NULL, 10);
+    settings->z2_min=strtol(input, NULL, 10);
     fprintf(stderr, "Input Z2 maximum (e.g. 92): ");
     fgets(input, 1000, stdin);
-    z2_max=strtol(input, NULL, 10);
-    n_combinations = (z1_max-z1_min+1)*(z2_max-z2_min+1);
+    settings->z2_max=strtol(input, NULL, 10);
+    free(input);
+}
 
-    fprintf(stopping_output_file, "source=srim\nz1-min=%i\nz1-max=%i\nz2-min=%i\nz2-max=%i\nsto-unit=eV/(1e15 atoms/cm2)\nx-unit=keV/u\nformat=ascii\nx-min=%e\nx-max=%e\nx-points=%i\nx-scale=log10\n==END-OF-HEADER==\n", z1_min, z1_max, z2_min, z2_max, xmin, xmax, xsteps);
-    i=0;
-    for(Z1=z1_min; Z1<=z1_max; Z1++) {
-        ion = find_most_abundant_isotope(isotopes, Z1);
-        for(Z2=z2_min; Z2<=z2_max; Z2++) {
-            i++;
-            target = find_most_abundant_isotope(isotopes, Z2);
-            fprintf(stopping_output_file, "#STOPPING IN Z1=%i Z2=%i\n", Z1, Z2);
-            if(ion && target) {
-                fprintf(stderr, "SR.IN will be generated for %s in %s.\n", ion->name, target->name);
-                generate_sr_in(SR_FILE_PATH, ion, target, xsteps, xmin, xmax);
-                fprintf(stderr, "Running SRModule, please wait.\n");
-                if(run_srim(SR_MODULE_PATH)) {
-                    if(parse_output(SR_OUTPUT_FILE, stopping_output_file, ion, xsteps)) {
-                        fprintf(stderr, "Z1=%i. Z2=%i. OK. %i/%i.\n", Z1, Z2, i, n_combinations);
-                    } else {
-                        fprintf(stderr, "Z1=%i. Z2=%i. Not OK %i/%i.\n", Z1, Z2, i, n_combinations);
-                    }
-                } else {
-                    fprintf(stderr, "Error in running SRModule. You should really consider running this program in the working directory of SR Module.\n");
-                    exit(0);
-                }
-            } else {
-                for(j=0; j<xsteps; j++) {
-                    fprintf(stopping_output_file, "%e\n", 0.0); /* no isotopes found for either Z1 or Z2, fill with zeros */
-                }
-                fflush(stdout);
-            }
+int main (int argc, char **argv) {
+    isotopes_t *isotopes=gsto_isotopes(); /* Compiled in table unless overridden by $GSTO_MASSES */
+    if(!isotopes) {
+        fprintf(stderr, "Could not load table of isotopes!\n");
+        return 0;
+    }
+    int i, success, interactive=1;
+    FILE *stopping_output_file;
+    char *start_dir=getcwd(NULL, 0); /* Relative output and image paths are relative to this */
+    srim_settings_t settings={NULL, NULL, NULL, 10.0, 10000.0, XSTEPS, 1, Z_MAX, 1, Z_MAX, 1, 0, NULL};
+    for(i=1; i<argc; i++) { /* srim_gen_stop [-j workers] [-c cache_dir] [settings_file] [key=value] ... */
+        if(strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+            settings.workers=strtol(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+            settings.cache_dir=argv[++i];
+        } else if(strchr(argv[i], '=')) {
+            if(!set_setting_line(&settings, argv[i]))
+                return 0;
+            interactive=0;
+        } else {
+            if(!read_settings(&settings, argv[i]))
+                return 0;
+            interactive=0;
         }
-        sleep(1);
     }
-    free(isotopes);
-    return 1;
+    if(interactive)
+        ask_settings(&settings);
+    if(!settings.output || !settings.srim_path) {
+        fprintf(stderr, "Settings output and srim-path are required.\n");
+        return 0;
+    }
+#ifdef WIN32
+    if(settings.binary) {
+        fprintf(stderr, "Binary output is not supported on Windows.\n");
+        return 0;
+    }
+#endif
+    if(settings.workers < 1 || settings.xsteps < 2 || settings.xmin <= 0.0 || settings.xmax <= settings.xmin || settings.z1_min < 1 || settings.z1_max < settings.z1_min || settings.z2_min < 1 || settings.z2_max < settings.z2_min) {
+        fprintf(stderr, "Invalid settings.\n");
+        return 0;
+    }
+    stopping_output_file = fopen(settings.output, settings.binary?"wb":"w");
+    if(!stopping_output_file) {
+        fprintf(stderr, "Could not open file \"%s\" for output", settings.output);
+        return 0;
+    }
+#ifndef WIN32
+    if(settings.cache_dir) { /* Workers run elsewhere, make the path absolute */
+        mkdir(settings.cache_dir, 0777);
+        settings.cache_dir=realpath(settings.cache_dir, NULL);
+        if(!settings.cache_dir) {
+            fprintf(stderr, "Could not use cache directory, error number %i.\n", errno);
+            return 0;
+        }
+    }
+#endif
+    fprintf(stderr, "Attempting to chdir to \"%s\"\n", settings.srim_path);
+    if(chdir(settings.srim_path) != 0) {
+        fprintf(stderr, "Could not chdir to given path. Error number %i.\n", errno);
+        return 0;
+    }
+
+    fprintf(stopping_output_file, "source=srim\nz1-min=%i\nz1-max=%i\nz2-min=%i\nz2-max=%i\nsto-unit=eV/(1e15 atoms/cm2)\nx-unit=keV/u\nformat=%s\nx-min=%e\nx-max=%e\nx-points=%i\nx-scale=log10\n==END-OF-HEADER==\n", settings.z1_min, settings.z1_max, settings.z2_min, settings.z2_max, settings.binary?"binary":"ascii", settings.xmin, settings.xmax, settings.xsteps);
+#ifdef WIN32
+    if(settings.workers > 1 || settings.cache_dir)
+        fprintf(stderr, "Workers and cache are not supported on Windows, running serially.\n");
+    success=run_pairs_serial(isotopes, stopping_output_file, &settings);
+#else
+    success=run_pairs(isotopes, stopping_output_file, &settings);
+#endif
+    fclose(stopping_output_file);
+    if(settings.image && chdir(start_dir) == 0)
+        success=write_image(&settings) && success;
+    free(start_dir);
+    return success;
 }
@@ -3,13 +3,18 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
 #ifdef WIN32
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <windows.h>
+#include <io.h> /* for _setmode() */
+#include <fcntl.h>
 #else
 #include <libgen.h> /* for basename() */
+#include <unistd.h> /* for sysconf() */
 #include <sys/param.h> /* for MAXPATHLEN */
 #endif
 /* #include <dirent.h> */
@@ -69,6 +74,7 @@
 #define ANGLE2      0.0
 
 #define C_MEVCM2_UG 1.0e-27
+#define C_UG_CM2_1E15ATOMS (1.0e-21*P_NA/M_C) /* ug/cm2 of carbon to 1e15 at./cm2 */
 
 #define Z_C         6
 #define M_C         12.0
@@ -79,8 +85,7 @@
 #define TRUE        1
 #define FALSE       0
 
-#define STOPSTEP    0.1
-#define CAL_ACC     0.02
+#define RANGEPOINTS 1001
 #define MAX_FACTOR  1.2
 
 #define EFF_MEV     C_MEV
@@ -90,10 +95,16 @@
 
 #define MAXELEMENTS 100
 
-#define MASS_FILE   DATAPATH/masses.dat
 #define STOP_DATA   DATAPATH/stopping.bin
 
 #define WORD_LENGTH 256
+#define CUT_FIELDS_MAX 4 /* ToF, energy, angle and event number */
+#define CHUNK_SIZE  (1<<20) /* Bytes of events converted by one job */
+#define EVENT_BLOCK 256 /* Events read and given random numbers at a time */
+#define OUTPUT_INITIAL 65536
+#define TOF_LIST_MAGIC "\211TOFLIST" /* Starts the output of -b, erd_depth and Potku look for this */
+#define TOF_LIST_MAGIC_LENGTH 8
+#define TOF_LIST_RECORD_SIZE 52 /* Packed double angle1, angle2, energy (MeV), int32 Z, double mass (u), int32 type (1 ERD, 0 RBS), double weight, int32 event number. Little-endian whatever the host byte order. */
 #define EFF_DIR_LENGTH 1024
 
 #define max(A,B)  ((A) > (B)) ? (A) : (B)
@@ -118,6 +129,49 @@ typedef struct {
    char eff_dir[EFF_DIR_LENGTH];
 } Input;
 
+typedef struct {
+   FILE *fp;
+   int fields; /* Per event in a binary cut file, 0 if events are lines of text, -1 if the file is skipped */
+   uint64_t stream; /* Hash of the file name extension, cut files get independent random numbers */
+   int tech;
+   float user_weight;
+   char *data; /* Events, everything after the header */
+   size_t size;
+} Cut;
+
+typedef struct {
+   int cut; /* Index to cuts */
+   char *start; /* Events from whole lines or records of cuts[cut].data */
+   char *end;
+   char *out; /* Output lines of these events */
+   size_t out_len;
+   size_t out_size;
+   int error; /* Stopped at a line that could not be read */
+} Chunk;
+
+typedef struct { /* Everything the threads share, read only except for their own cut or chunk */
+   Input *input;
+   Cut *cuts;
+   Chunk *chunks;
+   int *Z;
+   double *M;
+   double *M2;
+   double *emax;
+   double ***weight;
+   gsto_range_t **sto;
+   int noweight;
+   uint64_t seed; /* Of the channel randomization */
+   int binary; /* Packed records instead of lines of text */
+} Conversion;
+
+typedef struct {
+   void (*job)(void *, int);
+   void *arg;
+   int n_jobs;
+   int next;
+   pthread_mutex_t lock;
+} Jobs;
+
 /*
 
 # awk '{print ($1*-0.6339980E-10 + 0.5130320E-06)}' test2.out
@@ -145,16 +199,56 @@ theta,fii,target angle,E,Z,M,ERD/RBS,w,#
 
 */
 
-double **set_sto(gsto_table_t *, double, double, double);
+gsto_range_t *set_sto(gsto_resample_cache_t *, gsto_table_t *, gsto_mixture_t *, double, double, double);
 double **set_weight(char *,int,Input *);
 double get_weight(double **,double);
 double get_mass(char *,int *);
 double get_energy(double,double,double);
-double get_eloss(double,double **);
-/* int get_step(double,double **); */
 void read_input(const char *, Input *);
 double ipow(double,int);
 char *filename_extension(const char *);
+int parse_ints(const char *, int *, int);
+int cut_binary_fields(const char *);
+void read_events(void *, int);
+int split_chunks(Cut *, int, Chunk *);
+uint64_t name_hash(const char *);
+void event_randoms(uint64_t, uint64_t, const int *, double *, int);
+void convert_chunk(void *, int);
+int pack_event(char *, double, double, double, int, double, int, double, int);
+void *job_worker(void *);
+void run_jobs(void (*)(void *, int), void *, int, int);
+int n_processors(void);
+
+static inline int32_t get_le32(const unsigned char *p) /* Little-endian int32 of binary cut files */
+{
+   return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static inline void put_le32(char *out, int32_t value) /* Little-endian int32 of the records of -b */
+{
+   uint32_t u = (uint32_t)value;
+   int i;
+   for(i=0; i < 4; i++, u >>= 8)
+      out[i] = (char)(u & 0xff);
+}
+
+static inline void put_le64(char *out, double value) /* Little-endian IEEE 754 double of the records of -b */
+{
+   uint64_t u;
+   int i;
+   memcpy(&u, &value, 8);
+   for(i=0; i < 8; i++, u >>= 8)
+      out[i] = (char)(u & 0xff);
+}
+
+static inline double event_random(uint64_t seed, uint64_t stream, int evnum) /* Uniform in [0,1), depends only on the seed, the stream of the cut file and the event number so conversion can be done in any order (splitmix64) */
+{
+   uint64_t x = ((uint64_t)(uint32_t)evnum + 1)*0x9E3779B97F4A7C15ULL + ((seed*0xD1B54A32D192ED03ULL) ^ stream);
+   x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27))*0x94D049BB133111EBULL;
+   x ^= x >> 31;
+   return (x >> 11)*(1.0/9007199254740992.0);
+}
 
 int main(int argc, char *argv[])
 {
@@ -163,14 +257,40 @@ int main(int argc, char *argv[])
 /* struct dirent **files; */
 
    char **symbol,*tmp;
-   int evnum,i,noweight=FALSE,tech=ERD,tmpi,*Z,ZZ;
-   int e,tof;
+   int i,j,noweight=FALSE,tech=ERD,tmpi,*Z,ZZ;
+   int n_threads=n_processors(),n_chunks,error;
+   uint64_t seed=0;
+   int binary=FALSE,n_args;
 /* int *step; */
-   double beamM,energy,*emax,*M,*M2,tmpd,***sto,***weight;
+   double beamM,*emax,*M,*M2,***weight;
    gsto_table_t *table;
-
+   gsto_mixture_t *foil;
+   gsto_resample_cache_t *cache=NULL;
+   gsto_range_t **sto;
+   Cut *cuts;
+   Chunk *chunks;
+   Conversion conversion;
+
+   while(argc > 1 && argv[1][0] == '-'){
+      n_args = 2;
+      if(strcmp(argv[1], "-b") == 0){ /* Packed binary records, see TOF_LIST_RECORD_SIZE */
+         binary = TRUE;
+         n_args = 1;
+      } else if(argc > 2 && strcmp(argv[1], "-j") == 0){ /* Cut files are converted by this many threads */
+         n_threads = atoi(argv[2]);
+      } else if(argc > 2 && strcmp(argv[1], "--seed") == 0){ /* Same seed, same randomization of channels */
+         seed = strtoull(argv[2], NULL, 0);
+      } else {
+         fprintf(stderr, "Unknown option %s\n", argv[1]);
+         argc = 0;
+         break;
+      }
+      argv[n_args] = argv[0];
+      argv += n_args;
+      argc -= n_args;
+   }
    if(argc < 3){
-      printf("Usage: tof_list [config_file] [filename] [filename] ...\n");
+      printf("Usage: tof_list [-b] [-j threads] [--seed seed] [config_file] [filename] [filename] ...\n");
       exit(1);
    }
    const char *tofin_filename = argv[1];
@@ -198,8 +318,9 @@ int main(int argc, char *argv[])
    M = (double *) malloc(sizeof(double)*(argc));
    M2 = (double *) malloc(sizeof(double)*(argc));
 /*   tof = (double *) malloc(sizeof(double)*(argc)); */
-   sto = (double ***) malloc(sizeof(double **)*(argc));
+   sto = (gsto_range_t **) malloc(sizeof(gsto_range_t *)*(argc));
    weight = (double ***) malloc(sizeof(double **)*(argc));
+   cuts = (Cut *) calloc(argc, sizeof(Cut));
 
    read_input(tofin_filename, &input);
 
@@ -216,22 +337,34 @@ int main(int argc, char *argv[])
    else for(; i>-1; i--,argv[1]--);
 
 */
-    table=gsto_init(MAXELEMENTS, XSTR(STOPPING_DATA));
-    if(!table) {
-        fprintf(stderr, "Could not init stopping table.\n");
-        return 0;
-    }
-    gsto_auto_assign_range(table, 1, MAXELEMENTS, 6, 6); /* TODO: only assign relevant stopping */
-    if(!gsto_load(table)) {
-        fprintf(stderr, "Error in loading stopping.\n");
-        return 0;
+    if(getenv("GSTO_SHM")) { /* Share one loaded copy of the stopping between processes */
+        table=gsto_init_shm(MAXELEMENTS, XSTR(STOPPING_DATA), getenv("GSTO_SHM"));
+        if(!table) {
+            fprintf(stderr, "Could not init stopping table.\n");
+            return 0;
+        }
+    } else {
+        table=gsto_init(MAXELEMENTS, XSTR(STOPPING_DATA));
+        if(!table) {
+            fprintf(stderr, "Could not init stopping table.\n");
+            return 0;
+        }
+        gsto_set_lazy(table, 1); /* Only the stopping that is looked up gets assigned and loaded */
+        if(!gsto_load(table)) {
+            fprintf(stderr, "Error in loading stopping.\n");
+            return 0;
+        }
     }
+    if(getenv("GSTO_CACHE")) /* Resampled stopping is reused by later runs */
+        cache=gsto_resample_cache_allocate(getenv("GSTO_CACHE"));
+    foil=gsto_mixture_allocate(MAXELEMENTS);
+    gsto_mixture_set_fraction(foil, Z_C, 1.0);
     for(i=0; i<argc; i++){
       char *filename=argv[i];
       fprintf(stderr, "file %i is \"%s\"\n", i, filename);
       input.ecalib[i] = 0.0;
       symbol[i] = (char *) malloc(sizeof(char)*3);
-      fp[i] = fopen(filename, "r");
+      fp[i] = fopen(filename, "rb"); /* Binary for binary cut files, lines are read with fgets() */
       if(fp[i] == NULL){
          fprintf(stderr,"Could not open data file %s\n", filename);
          exit(2);
@@ -239,6 +372,7 @@ int main(int argc, char *argv[])
       char *extension = filename_extension(filename);
       fprintf(stderr, "extension: %s\n", extension);
       char *extension_orig=extension;
+      cuts[i].stream = name_hash(extension); /* Not the whole path, the same cut gives the same events wherever it is */
       Z[i]=0;
       while(isdigit(*extension)) Z[i] = Z[i]*10 + *extension++ - '0';
       while(isalpha(*extension)) *symbol[i]++ = *extension++; *symbol[i] = '\0';
@@ -251,7 +385,7 @@ int main(int argc, char *argv[])
       tmpi = input.beamZ;
       beamM = get_mass(input.beam,&tmpi);
       emax[i] = input.beamE;
-      sto[i] = set_sto(table, (Z[i])?Z[i]:ZZ,M[i],emax[i]*MAX_FACTOR);
+      sto[i] = set_sto(cache, table, foil, ZZ,M[i],emax[i]*MAX_FACTOR); /* Z[i] is the mass number here */
       fprintf(stderr, "For stopping purposes (in carbon foil), this is Z=%i and mass is %g u\n", ZZ, M[i]/C_U);
 /*    step[i] = get_step(emax[i]*MAX_FACTOR,sto[i]); */
       weight[i] = set_weight(symbol[i],Z[i],&input);
@@ -269,6 +403,8 @@ int main(int argc, char *argv[])
       }
       free(extension_orig);
    }
+   gsto_mixture_deallocate(foil);
+   gsto_resample_cache_deallocate(cache);
    gsto_deallocate(table); /* Stopping data loaded in already, this is not used anymore */
    int derp_n;
    float user_weight = 1.0;
@@ -282,6 +418,8 @@ int main(int argc, char *argv[])
    for(i=0; i < argc; i++){
       fprintf(stderr, "Processing file %i.\n", i);
 	  tech = ERD;
+      cuts[i].fp = fp[i];
+      cuts[i].fields = 0;
       /* Don't read the first ten lines, except the one line which
          contains the user-specified weight factor which is memorized. */
       for(derp_n=0;derp_n<10;derp_n++){
@@ -322,40 +460,57 @@ int main(int argc, char *argv[])
 #endif
 			*/
          }
+         if(derp_n == 9){ //line number10 in cut file = column names, "Binary: ..." if events are binary records
+            cuts[i].fields = cut_binary_fields(herp_c);
+            if(cuts[i].fields < 0)
+               fprintf(stderr, "Skipping cut file %s\n", argv[i]);
+            else if(cuts[i].fields)
+               fprintf(stderr, "Binary cut file, %i fields per event\n", cuts[i].fields);
+         }
 
 	  }
-       char *line = (char *) malloc(sizeof(char)*WORD_LENGTH);
-       int ang1;
-       double angle1;
-       while(fgets(line, WORD_LENGTH, fp[i])) {
-           if(sscanf(line, "%i %i %i %i", &tof, &e, &ang1, &evnum) == 4) {
-                angle1=ang1*input.acalib1+input.acalib2;
-           } else if(sscanf(line, "%i %i %i", &tof, &e, &evnum) == 3) {
-                angle1=0.0;
-           } else {
-               fprintf(stderr, "Error in scanning input file.\n");
-               break;
-           }
-         if(e > 0){
-            if(tof == 0){
-               energy  = e + ((double)(rand())/RAND_MAX) - 0.5;
-               energy *= input.ecalib[i];
-               energy *= C_MEV;
-            } else {
-               energy = tof +  ((double)(rand())/RAND_MAX) - 0.5;
-               energy = get_energy(input.tof,energy*input.calib1 + input.calib2,M[i]);
-            }
-            tmpd = get_eloss(energy,sto[i]);
-            energy = (tmpd > -0.1)?energy + tmpd*input.foil_thick:-1.0;
-            if(energy > -0.1 && energy < emax[i]*MAX_FACTOR){
-               printf("%e %e ",angle1,ANGLE2);
-               //printf("%10.5lf %3d %8.4f ",energy/C_MEV,Z[i],M[i]/C_U); // Original
-               printf("%10.5lf %3d %8.4f ",energy/C_MEV, Z[i], (tech == RBS)?M2[i]/C_U:M[i]/C_U);
-               printf("%s %6.3f %5d\n",(tech)?"ERD":"RBS",(noweight)?1.0:get_weight(weight[i],energy)*user_weight,evnum);
-            }
+      cuts[i].tech = tech;
+      cuts[i].user_weight = user_weight;
+   }
+   conversion.input = &input;
+   conversion.cuts = cuts;
+   conversion.Z = Z;
+   conversion.M = M;
+   conversion.M2 = M2;
+   conversion.emax = emax;
+   conversion.weight = weight;
+   conversion.sto = sto;
+   conversion.noweight = noweight;
+   conversion.seed = seed;
+   conversion.binary = binary;
+   run_jobs(read_events, &conversion, argc, n_threads);
+   for(i=0,n_chunks=0; i < argc; i++)
+      n_chunks += split_chunks(&cuts[i], i, NULL);
+   chunks = (Chunk *) calloc(n_chunks, sizeof(Chunk));
+   for(i=0,n_chunks=0; i < argc; i++)
+      n_chunks += split_chunks(&cuts[i], i, chunks+n_chunks);
+   conversion.chunks = chunks;
+   run_jobs(convert_chunk, &conversion, n_chunks, n_threads);
+   if(binary){
+#ifdef WIN32
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      fwrite(TOF_LIST_MAGIC, 1, TOF_LIST_MAGIC_LENGTH, stdout);
+   }
+   for(i=0,j=0; i < argc; i++){ /* In the order of the arguments, a file ends at the first line that could not be read */
+      for(error=FALSE; j < n_chunks && chunks[j].cut == i; j++){
+         if(!error)
+            fwrite(chunks[j].out, 1, chunks[j].out_len, stdout);
+         if(!error && chunks[j].error){
+            fprintf(stderr, "Error in scanning input file.\n");
+            error=TRUE;
          }
+         free(chunks[j].out);
       }
+      free(cuts[i].data);
    }
+   free(chunks);
+   free(cuts);
 
 #if 0
    for(i=0; i<argc-1; i++)
@@ -397,24 +552,252 @@ int main(int argc, char *argv[])
 
 }
 
-double **set_sto(gsto_table_t *table, double z, double m, double e)
+void read_events(void *arg, int i) /* All events of cuts[i] into memory, after the header */
+{
+   Conversion *conversion = arg;
+   Cut *cut = &conversion->cuts[i];
+   size_t n,size=CHUNK_SIZE;
+   cut->data = (char *) malloc(size+1);
+   cut->size = 0;
+   while(cut->fields >= 0 && (n = fread(cut->data+cut->size, 1, size-cut->size, cut->fp)) > 0){
+      cut->size += n;
+      if(cut->size == size){
+         size *= 2;
+         cut->data = (char *) realloc(cut->data, size+1);
+      }
+   }
+   cut->data[cut->size] = '\0';
+}
+
+int split_chunks(Cut *cut, int i, Chunk *chunks) /* Chunks of about CHUNK_SIZE bytes ending at a line or a record, only counted if chunks is NULL */
+{
+   int n;
+   size_t record=sizeof(int32_t)*cut->fields;
+   char *start=cut->data,*end,*data_end=cut->data+cut->size;
+   if(cut->fields < 0)
+      return 0;
+   if(record)
+      data_end -= cut->size%record; /* Not a whole record */
+   for(n=0; start < data_end; n++,start=end){
+      if(data_end-start <= CHUNK_SIZE)
+         end = data_end;
+      else if(record)
+         end = start + CHUNK_SIZE - CHUNK_SIZE%record;
+      else if((end = memchr(start+CHUNK_SIZE, '\n', data_end-start-CHUNK_SIZE)))
+         end++;
+      else
+         end = data_end;
+      if(chunks){
+         chunks[n].cut = i;
+         chunks[n].start = start;
+         chunks[n].end = end;
+      }
+   }
+   return n;
+}
+
+void event_randoms(uint64_t seed, uint64_t stream, const int *evnum, double *random, int n) /* event_random() of n events */
+{
+   int i;
+   for(i=0; i < n; i++)
+      random[i] = event_random(seed, stream, evnum[i]);
+}
+
+void convert_chunk(void *arg, int k) /* Output lines of the events of chunks[k] */
+{
+   Conversion *conversion = arg;
+   Input *input = conversion->input;
+   Chunk *chunk = &conversion->chunks[k];
+   Cut *cut = &conversion->cuts[chunk->cut];
+   int i = chunk->cut;
+   char *p,*end,line[WORD_LENGTH];
+   int j,n,n_fields,fields[CUT_FIELDS_MAX],len;
+   int tof[EVENT_BLOCK],e[EVENT_BLOCK],evnum[EVENT_BLOCK];
+   double energy,mass,w,angle1[EVENT_BLOCK],random[EVENT_BLOCK];
+   chunk->out_size = OUTPUT_INITIAL;
+   chunk->out = (char *) malloc(chunk->out_size);
+   chunk->out_len = 0;
+   chunk->error = FALSE;
+   for(p=chunk->start; p < chunk->end && !chunk->error;){
+      for(n=0; n < EVENT_BLOCK && p < chunk->end; n++){
+         if(cut->fields) { /* Binary records of little-endian int32 ToF, energy, (angle,) event number */
+            for(n_fields=0; n_fields < cut->fields; n_fields++, p += sizeof(int32_t))
+               fields[n_fields] = get_le32((unsigned char *)p);
+         } else {
+            end = memchr(p, '\n', chunk->end-p);
+            if(!end)
+               end = chunk->end; /* Last line without a newline, data is terminated */
+            *end = '\0';
+            n_fields = parse_ints(p, fields, CUT_FIELDS_MAX);
+            if(n_fields < 0) { /* Not plain decimal, sscanf() decides as before */
+               if(sscanf(p, "%i %i %i %i", &fields[0], &fields[1], &fields[2], &fields[3]) == 4)
+                  n_fields = 4;
+               else if(sscanf(p, "%i %i %i", &fields[0], &fields[1], &fields[2]) == 3)
+                  n_fields = 3;
+            }
+            p = end+1;
+         }
+         tof[n] = fields[0];
+         e[n] = fields[1];
+         if(n_fields == 4) {
+            evnum[n] = fields[3];
+            angle1[n] = fields[2]*input->acalib1+input->acalib2;
+         } else if(n_fields == 3) {
+            evnum[n] = fields[2];
+            angle1[n] = 0.0;
+         } else {
+            chunk->error = TRUE;
+            break;
+         }
+      }
+      event_randoms(conversion->seed, cut->stream, evnum, random, n);
+      for(j=0; j < n; j++){
+         if(e[j] <= 0)
+            continue;
+         if(tof[j] == 0){
+            energy  = e[j] + random[j] - 0.5;
+            energy *= input->ecalib[i];
+            energy *= C_MEV;
+         } else {
+            energy = tof[j] + random[j] - 0.5;
+            energy = get_energy(input->tof,energy*input->calib1 + input->calib2,conversion->M[i]);
+         }
+         if(conversion->sto[i])
+            energy = gsto_range_E_after(conversion->sto[i], conversion->M[i], energy, -input->foil_thick*C_UG_CM2_1E15ATOMS); /* Energy before the carbon foil */
+         if(energy > -0.1 && energy < conversion->emax[i]*MAX_FACTOR){
+            mass = (cut->tech == RBS)?conversion->M2[i]/C_U:conversion->M[i]/C_U;
+            w = (conversion->noweight)?1.0:get_weight(conversion->weight[i],energy)*cut->user_weight;
+            if(conversion->binary)
+               len = pack_event(line, angle1[j], ANGLE2, energy/C_MEV, conversion->Z[i], mass, cut->tech, w, evnum[j]);
+            else
+               len = snprintf(line, WORD_LENGTH, "%e %e %10.5lf %3d %8.4f %s %6.3f %5d\n",
+                              angle1[j], ANGLE2, energy/C_MEV, conversion->Z[i], mass, (cut->tech)?"ERD":"RBS", w, evnum[j]);
+            if(chunk->out_len + len >= chunk->out_size){
+               chunk->out_size *= 2;
+               chunk->out = (char *) realloc(chunk->out, chunk->out_size);
+            }
+            memcpy(chunk->out + chunk->out_len, line, len);
+            chunk->out_len += len;
+         }
+      }
+   }
+}
+
+int pack_event(char *out, double angle1, double angle2, double energy, int z, double mass, int tech, double w, int evnum) /* One record of TOF_LIST_RECORD_SIZE bytes */
+{
+   put_le64(out, angle1);
+   put_le64(out+8, angle2);
+   put_le64(out+16, energy);
+   put_le32(out+24, z);
+   put_le64(out+28, mass);
+   put_le32(out+36, tech);
+   put_le64(out+40, w);
+   put_le32(out+48, evnum);
+   return TOF_LIST_RECORD_SIZE;
+}
+
+void *job_worker(void *arg)
+{
+   Jobs *jobs = arg;
+   int i;
+   while(1){
+      pthread_mutex_lock(&jobs->lock);
+      i = jobs->next++;
+      pthread_mutex_unlock(&jobs->lock);
+      if(i >= jobs->n_jobs)
+         break;
+      jobs->job(jobs->arg, i);
+   }
+   return NULL;
+}
+
+void run_jobs(void (*job)(void *, int), void *arg, int n_jobs, int n_threads) /* job(arg, i) for i=0..n_jobs-1 on up to n_threads threads (this one included), returns when all are done */
+{
+   Jobs jobs;
+   pthread_t *threads;
+   int i,n_started;
+   jobs.job = job;
+   jobs.arg = arg;
+   jobs.n_jobs = n_jobs;
+   jobs.next = 0;
+   pthread_mutex_init(&jobs.lock, NULL);
+   if(n_threads > n_jobs)
+      n_threads = n_jobs;
+   threads = (pthread_t *) malloc(sizeof(pthread_t)*(n_threads > 1?n_threads:1));
+   for(n_started=0; n_started < n_threads-1; n_started++)
+      if(pthread_create(&threads[n_started], NULL, job_worker, &jobs) != 0)
+         break; /* The threads that did start do the jobs */
+   job_worker(&jobs);
+   for(i=0; i < n_started; i++)
+      pthread_join(threads[i], NULL);
+   free(threads);
+   pthread_mutex_destroy(&jobs.lock);
+}
+
+int n_processors(void)
+{
+#ifdef WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors;
+#else
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return (n > 0)?n:1;
+#endif
+}
+
+int parse_ints(const char *s, int *values, int n_max) /* Reads up to n_max decimal integers separated by white space like sscanf("%i %i ...") would, returns how many. -1 if a number might be octal or hexadecimal. */
+{
+   int n,negative;
+   long value;
+   for(n=0; n < n_max; n++){
+      while(isspace((unsigned char)*s)) s++;
+      negative = (*s == '-');
+      if(*s == '-' || *s == '+') s++;
+      if(!isdigit((unsigned char)*s))
+         break;
+      if(*s == '0' && isalnum((unsigned char)s[1]))
+         return -1;
+      for(value=0; isdigit((unsigned char)*s); s++)
+         value = value*10 + *s - '0';
+      values[n] = negative?-value:value;
+   }
+   return n;
+}
+
+uint64_t name_hash(const char *name) /* FNV-1a */
+{
+   uint64_t hash=14695981039346656037ULL;
+   for(; *name; name++){
+      hash ^= (unsigned char)*name;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+int cut_binary_fields(const char *line) /* Fields per event if the column name line is e.g. "Binary: ToF, Energy, Event number", 0 for text, -1 if the fields are not supported */
 {
-    int i,n;
-    double **sto;
-    double E, S;
+   int n=1;
+   if(strncmp(line, "Binary:", 7) != 0)
+      return 0;
+   for(; *line; line++)
+      if(*line == ',') n++;
+   if(n != 3 && n != 4){
+      fprintf(stderr, "Binary cut files have 3 or 4 fields per event, not %i\n", n);
+      return -1;
+   }
+   return n;
+}
+
+gsto_range_t *set_sto(gsto_resample_cache_t *cache, gsto_table_t *table, gsto_mixture_t *foil, double z, double m, double e)
+{
+    gsto_range_t *range;
     fprintf(stderr, "set_sto(%p, z=%g, m=%g u, e=%g keV)\n", table, z, m/C_U, e/C_KEV);
-    n=(int) (e/(STOPSTEP*C_MEV))+1;
-    sto = malloc(sizeof(double *)*2);
-    sto[0]=calloc(n, sizeof(double));
-    sto[1]=calloc(n, sizeof(double));
-    for(i=0; i<n; i++){
-        E=i*STOPSTEP*C_MEV;
-        S=gsto_sto_v(table, z, 6, velocity(E, m));
-        sto[0][i] = E;
-        sto[1][i] = S*C_MEVCM2_UG*C_MEV*P_NA/M_C;
-    }
+    range = gsto_range_build_cached(cache, table, foil, z, sqrt(2.0*e/m), RANGEPOINTS);
+    if(!range) /* As without stopping before, events are converted without the energy loss in the foil */
+        fprintf(stderr, "Warning: could not calculate range of z=%g in the carbon foil, no foil correction\n", z);
 
-   return(sto);
+   return(range);
 
 }
 
@@ -496,43 +879,39 @@ double get_weight(double **table, double e)
 
 double get_mass(char *symbol, int *z) /* The second parameter (int *z) is actually mass number A as an input (with *z==0 we assume natural isotopic distribution) and simultaneously this function stores the proton number (Z) into z. So the same variable acts both as an input and an output and has different meanings. Whoever programmed this will be first against the wall when the revolution comes. */
 {
-   FILE *fp;
-   char S[3];
-   int A,N,Z;
-   double C,M,MC=0.0,MM=0.0;
+   isotopes_t *isotopes = gsto_isotopes();
+   isotope_t *isotope;
+   char name[MAX_ELEMENT_NAME];
+   int i,Z;
+   double MC=0.0,MM=0.0;
    fprintf(stderr, "Trying to find mass for \"%s\" (mass number A is %i)\n", symbol, *z);
 
-   fp = fopen(XSTR(MASS_FILE),"r");
-   if(fp == NULL){
-      fprintf(stderr,"Could not open element mass file %s\n",XSTR(MASS_FILE));
+   if(isotopes == NULL){
+      fprintf(stderr,"Could not load the table of isotopes\n");
       exit(4);
    }
 
    if(*z == 0){
-      while(fscanf(fp,"%i %i %i %s %lf %lf\n",&N,&Z,&A,S,&M,&C) == 6){
-         if(strcmp(symbol,S) == 0){
-            MM += M*C;
-            if(C>MC){
-               MC = C;
-               *z = Z;
-            }
+      Z = find_Z_by_name(isotopes,symbol);
+      for(i=isotopes->Z_first[Z];i<isotopes->Z_first[Z+1];i++){
+         isotope = &isotopes->i[i];
+         MM += isotope->mass_micro_u*isotope->abundance_percent;
+         if(isotope->abundance_percent>MC){
+            MC = isotope->abundance_percent;
+            *z = Z;
          }
       }
       MM /= 100.0;
-      if((int)(MM)){
-         fclose(fp);
+      if((int)(MM))
          return(MM*C_U/1.0e6);
+   } else {
+      snprintf(name,MAX_ELEMENT_NAME,"%i-%s",*z,symbol);
+      isotope = find_isotope_by_name(isotopes,name);
+      if(isotope){
+         *z = isotope->Z;
+         return(isotope->mass_micro_u*C_U/1.0e6);
       }
-   } else
-	  //printf("else osa");
-	  //printf("%i", *z);
-      while(fscanf(fp,"%i %i %i %s %lf %lf\n",&N,&Z,&A,S,&M,&C) == 6)
-         if(strcmp(symbol,S) == 0 && *z == A){
-            fclose(fp);
-			//printf("%i", *z);
-            *z = Z;
-            return(M*C_U/1.0e6);
-         }
+   }
 
    fprintf(stderr,"Could not find element %s\n",symbol);
    exit(5);
@@ -550,53 +929,6 @@ double get_energy(double s, double t, double m)
 
 }
 
-double get_eloss(double e, double **sto)
-{
-   double s;
-   int i;
-
-   i = (int) (e/(STOPSTEP*C_MEV));
-
-   i = max(0,i);
-
-   if(e < sto[0][i])
-      i--;
-
-   if(e >= sto[0][i+1])
-      i++;
-
-   s = sto[1][i] + (sto[1][i+1] - sto[1][i])*(e - sto[0][i])/(sto[0][i+1] - sto[0][i]);
-
-   if(s < 0 || s > e) s = -1.0;
-
-   return(s);
-
-}
-
-
-/*
-
-int get_step(double e, double **sto)
-{
-   int i=2,j;
-   double esect,next,prev;
-
-   prev = get_eloss(e,sto); next = prev*2;
-   while(((next>prev)?next/prev:prev/next)>1.0+CAL_ACC){
-      next = 0.0; esect = e;
-      for(j=0; j<i; j++){
-         next += get_eloss(esect,sto)/i;
-         esect = e + prev/i;
-      }
-      i *= 2;
-   }
-
-   return(i);
-
-}
-
-*/
-
 void read_input(const char *input_file, Input *input)
 {
    FILE *fp;
@@ -89,7 +89,8 @@ class DepthFileGenerator:
             tof_bin = "./tof_list"
             erd_bin = "./erd_depth"
 
-        return (tof_bin, str(self._tof_in_file),
+        # tof_list passes events to erd_depth as packed binary records
+        return (tof_bin, "-b", str(self._tof_in_file),
                 *(str(f) for f in self._cut_files)), \
                (erd_bin, str(self._output_path), str(self._tof_in_file))
 
@@ -224,22 +224,23 @@ class EnergySpectrum:
         try:
             with subprocess.Popen(
                     cmd, cwd=gf.get_bin_dir(), stdout=subprocess.PIPE,
-                    universal_newlines=True, stderr=stderr) as tof_list:
+                    stderr=stderr) as tof_list:
+
+                # tof_list writes packed binary records instead of text
+                tof_list_data = tof_parser.parse_bytes(tof_list.stdout.read())
 
                 if directory is not None:
                     directory.mkdir(exist_ok=True)
                     tof_list_file = EnergySpectrum.get_tof_list_file_name(
                         directory, cut_file, no_foil=no_foil)
-                else:
-                    tof_list_file = None
-
-                tof_list_data = sutils.process_output(
-                    tof_list,
-                    tof_parser.parse_str,
-                    file=tof_list_file,
-                    text_func=lambda x: f"{' '.join(str(col) for col in x)}\n"
-                )
-                return tof_list_data
+                    tof_list_data = sutils.write_to_file(
+                        tof_list_data,
+                        tof_list_file,
+                        text_func=lambda x:
+                            f"{' '.join(str(col) for col in x)}\n"
+                    )
+
+                return list(tof_list_data)
         except Exception as e:
             msg = f"Error in tof_list: {e}"
             if logger is not None:
@@ -249,14 +250,14 @@ class EnergySpectrum:
             return []
 
     @staticmethod
-    def get_command(tof_in: Path, cut_file: Path) -> Tuple[str, str, str]:
-        """Returns the command for running tof_list.
+    def get_command(tof_in: Path, cut_file: Path) -> Tuple[str, ...]:
+        """Returns the command for running tof_list with binary output.
         """
         if platform.system() == 'Windows':
             executable = str(gf.get_bin_dir() / "tof_list.exe")
         else:
             executable = "./tof_list"
-        return executable, str(tof_in), str(cut_file)
+        return executable, "-b", str(tof_in), str(cut_file)
 
     @staticmethod
     def get_tof_list_file_name(
@@ -27,6 +27,8 @@ data.
 __author__ = "Juhani Sundell"
 __version__ = "2.0"
 
+import struct
+
 
 class CSVParser:
     """CSVParser parses csv-formatted strings by splitting rows into columns
@@ -200,6 +202,12 @@ class ToFListParser(CSVParser):
     """Default parser for reading data in the format produced by tof_list"""
     __slots__ = ()
 
+    # tof_list -b writes this followed by packed little-endian records of
+    # angle1, angle2, energy, Z, mass, type (1 for ERD, 0 for RBS), weight
+    # and event number.
+    BINARY_MAGIC = b"\x89TOFLIST"
+    BINARY_RECORD = struct.Struct("<dddididi")
+
     def __init__(self):
         """Initializes a ToFListParses.
         """
@@ -213,6 +221,30 @@ class ToFListParser(CSVParser):
                          (6, float),
                          (7, int))
 
+    def parse_bytes(self, data):
+        """Parses the binary output of tof_list -b.
+
+        Energy, mass and weight are rounded to the precision of the text
+        output so that the results are the same with either output.
+
+        Args:
+            data: bytes written by tof_list -b
+
+        Yield:
+            tuple of values for each event, in the same order and types as
+            parse_str returns for a line of text output
+        """
+        magic = ToFListParser.BINARY_MAGIC
+        if data[:len(magic)] != magic:
+            raise ValueError("Data is not binary output of tof_list")
+        end = len(data) - (len(data) - len(magic)) % \
+            ToFListParser.BINARY_RECORD.size
+        for angle1, angle2, energy, z, mass, typ, weight, evnum in \
+                ToFListParser.BINARY_RECORD.iter_unpack(
+                    data[len(magic):end]):
+            yield (angle1, angle2, round(energy, 5), z, round(mass, 4),
+                   "ERD" if typ else "RBS", round(weight, 3), evnum)
+
 
 def _get_conversion_function(idx, func):
     """Returns a function that will be applied to a list element
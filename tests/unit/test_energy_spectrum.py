@@ -29,10 +29,12 @@ import tests.mock_objects as mo
 import tests.utils as utils
 import tempfile
 import os
+import struct
 import numpy as np
 
 from pathlib import Path
 
+from modules.cut_file import CutFile
 from modules.energy_spectrum import EnergySpectrum
 from modules.parsing import ToFListParser
 
@@ -217,6 +219,58 @@ class TestCalculateMeasuredSpectra(unittest.TestCase):
         ]
 
 
+class TestBinaryCutFile(unittest.TestCase):
+    """binary.1H.ERD.0.cut has the events of cuts.1H.ERD.0.cut as
+    little-endian int32 records after a "Binary: ..." column name line.
+    """
+    def setUp(self):
+        self.resource_dir = utils.get_resource_dir()
+        self.text_cut = self.resource_dir / "cuts.1H.ERD.0.cut"
+        self.binary_cut = self.resource_dir / "binary.1H.ERD.0.cut"
+
+    def test_binary_cut_file_has_the_events_of_the_text_cut_file(self):
+        with self.binary_cut.open("rb") as file:
+            header = [file.readline() for _ in range(10)]
+            data = file.read()
+        self.assertEqual(b"Binary: ToF, Energy, Event number\n", header[9])
+        events = [list(event) for event in struct.iter_unpack("<3i", data)]
+
+        cut = CutFile()
+        cut.load_file(self.text_cut)
+        self.assertEqual(cut.data, events)
+
+    def test_tof_list_is_the_same_for_binary_and_text_cut_files(self):
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            tmp_dir = Path(tmp_dir)
+            mesu = mo.get_measurement(
+                path=tmp_dir / "mesu.info", save_on_creation=True)
+            tof_in = mesu.generate_tof_in()
+            expected = EnergySpectrum.tof_list(
+                self.text_cut, tof_in=tof_in, verbose=False)
+            actual = EnergySpectrum.tof_list(
+                self.binary_cut, tof_in=tof_in, verbose=False)
+
+            self.assertEqual(10, len(expected))
+            self.assertEqual(expected, actual)
+
+    def test_binary_cut_file_with_unsupported_fields_is_skipped(self):
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            tmp_dir = Path(tmp_dir)
+            mesu = mo.get_measurement(
+                path=tmp_dir / "mesu.info", save_on_creation=True)
+            tof_in = mesu.generate_tof_in()
+            cut_file = tmp_dir / "binary.1H.ERD.0.cut"
+            with self.binary_cut.open("rb") as file:
+                header = [file.readline() for _ in range(9)]
+                data = file.read()
+            cut_file.write_bytes(
+                b"".join(header) + b"Binary: ToF, Energy\n" +
+                data.split(b"\n", 1)[1])
+
+            self.assertEqual([], EnergySpectrum.tof_list(
+                cut_file, tof_in=tof_in, verbose=False))
+
+
 class TestGetTofListFileName(unittest.TestCase):
     def test_when_no_foil_is_false(self):
         directory = Path("tmp", "espes")
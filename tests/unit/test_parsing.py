@@ -29,6 +29,7 @@ __version__ = "2.0"
 import unittest
 import tempfile
 import os
+import struct
 
 import tests.utils as utils
 
@@ -241,6 +242,40 @@ class TestParsing(unittest.TestCase):
                                                  method="row",
                                                  separator="\t")))
 
+    def test_tof_list_binary_parsing(self):
+        """Tests that binary tof_list output parses like text output."""
+        parser = ToFListParser()
+        record = struct.Struct("<dddididi")
+        data = ToFListParser.BINARY_MAGIC + \
+            record.pack(0.0, 0.0, 0.537031234, 1, 1.00782503, 1, 1.0, 764) + \
+            record.pack(0.0, 0.0, 1.2, 25, 54.9380451, 0, 0.56789, 3)
+        text = [
+            "0.000000e+00 0.000000e+00 0.53703 1 1.0078 ERD 1.000 764",
+            "0.000000e+00 0.000000e+00 1.20000 25 54.9380 RBS 0.568 3"
+        ]
+        self.assertEqual(
+            [parser.parse_str(s) for s in text],
+            list(parser.parse_bytes(data)))
+
+        # An incomplete record at the end is ignored
+        self.assertEqual(1, len(list(parser.parse_bytes(data[:-1]))))
+
+        self.assertRaises(
+            ValueError, lambda: list(parser.parse_bytes(b"0.0 0.0 1.0")))
+
+    def test_tof_list_binary_output_of_tof_list(self):
+        """Tests that the binary output of tof_list parses like its text
+        output. Both were written by tof_list from the same ERD and RBS cut
+        files, see tests/resource/tof_list_output.*"""
+        parser = ToFListParser()
+        resource_dir = utils.get_resource_dir()
+        data = (resource_dir / "tof_list_output.bin").read_bytes()
+        with (resource_dir / "tof_list_output.txt").open("r") as file:
+            expected = [parser.parse_str(line) for line in file]
+
+        self.assertEqual(19, len(expected))
+        self.assertEqual(expected, list(parser.parse_bytes(data)))
+
     def test_parsers_have_slots(self):
         """Tests that __slots__ work in CSVParser.
         """